@@ -1,5 +1,6 @@
 #include "ListFunc.h"
 
+#include <algorithm>
 #include <fstream>
 
 
@@ -18,6 +19,11 @@ int ListFunc::run()
         {
             continue;
         }
+        else if (line[0] == ':')
+        {
+            command(line);
+            continue;
+        }
 
         try
         {
@@ -25,12 +31,13 @@ int ListFunc::run()
             std::vector<Token> tokens = lexer.lex();
 
             Parser parser(tokens.begin());
-            FunctionScope localScope(globalScope, nullptr, std::vector<std::shared_ptr<Node>>());
-            std::shared_ptr<Value> val = parser.parse(std::cout)->eval(localScope);
+            std::shared_ptr<FunctionScope> localScope = std::make_shared<FunctionScope>(
+                globalScope, nullptr, std::vector<std::shared_ptr<Node>>());
+            Value val = globalScope.evaluate(parser.parse(std::cout), *localScope);
 
             if (val)
             {
-                std::cout << "> " << val->toString() << '\n';
+                std::cout << "> " << val.toString() << '\n';
             }
         }
         catch (const std::runtime_error &execException)
@@ -65,6 +72,11 @@ int ListFunc::run(const char* path)
             {
                 continue;
             }
+            else if (line[0] == ':')
+            {
+                command(line);
+                continue;
+            }
 
             try
             {
@@ -72,12 +84,13 @@ int ListFunc::run(const char* path)
                 std::vector<Token> tokens = lexer.lex();
 
                 Parser parser(tokens.begin());
-                FunctionScope localScope(globalScope, nullptr, std::vector<std::shared_ptr<Node>>());
-                std::shared_ptr<Value> val = parser.parse(std::cout)->eval(localScope);
+                std::shared_ptr<FunctionScope> localScope = std::make_shared<FunctionScope>(
+                    globalScope, nullptr, std::vector<std::shared_ptr<Node>>());
+                Value val = globalScope.evaluate(parser.parse(std::cout), *localScope);
 
                 if (val)
                 {
-                    std::cout << "> " << val->toString() << '\n';
+                    std::cout << "> " << val.toString() << '\n';
                 }
             }
             catch (const std::runtime_error &execException)
@@ -98,4 +111,47 @@ int ListFunc::run(const char* path)
     std::cout << "Problem while opening file!\n";
 
     return run();
-}
\ No newline at end of file
+}
+
+void ListFunc::command(const std::string& line)
+{
+    const std::string effectsCommand = ":effects";
+
+    if (line.compare(0, effectsCommand.size(), effectsCommand) != 0 ||
+        (line.size() > effectsCommand.size() && line[effectsCommand.size()] != ' '))
+    {
+        std::cerr << "Unknown command " << line << std::endl;
+        return;
+    }
+
+    // Optional name of the functions to describe
+    std::string name = line.substr(effectsCommand.size());
+    name.erase(0, name.find_first_not_of(' '));
+    name.erase(name.find_last_not_of(' ') + 1);
+
+    EffectAnalysis &effects = globalScope.effects();
+    for (const EffectAnalysis::Function &function : effects.userFunctions())
+    {
+        const std::string &functionName = SymbolTable::name(function.first);
+        if (!name.empty() && name != functionName)
+        {
+            continue;
+        }
+
+        std::cout << functionName << '/' << function.second << ": "
+                  << EffectAnalysis::describe(effects.effectsOf(function, globalScope));
+
+        // The other functions of its recursive group
+        std::vector<EffectAnalysis::Function> group = effects.recursiveGroupOf(function, globalScope);
+        if (!group.empty())
+        {
+            std::cout << ", recursive";
+        }
+        group.erase(std::remove(group.begin(), group.end(), function), group.end());
+        for (size_t i = 0; i < group.size(); ++i)
+        {
+            std::cout << (i ? " " : " with ") << SymbolTable::name(group[i].first) << '/' << group[i].second;
+        }
+        std::cout << '\n';
+    }
+}
@@ -22,9 +22,30 @@ public:
     int run();
     int run(const char* path);
 
+    //! Selects the engine which evaluates the input
+    void setEngine(GlobalScope::Engine engine)
+    {
+        globalScope.setEngine(engine);
+    }
+
+    //! Limits the number of nested calls of the bytecode engine
+    void setMaxDepth(size_t depth)
+    {
+        globalScope.setMaxDepth(depth);
+    }
+
+    //! Enables memoization of pure recursive functions
+    void setMemoization(bool enabled)
+    {
+        globalScope.setMemoization(enabled);
+    }
+
 private:
     GlobalScope globalScope;
 
+    //! Runs a REPL command, e.g. ":effects" which prints the effects of the user functions
+    void command(const std::string& line);
+
     //! Loads default library
     ListFunc()
     {
@@ -0,0 +1,338 @@
+#include "effects.h"
+#include "interpreter.h"
+#include "optimizer.h"
+
+#include <algorithm>
+
+
+namespace
+{
+
+//! Pre-defined function which calls the function passed as one of its arguments
+struct HigherOrderBuiltin
+{
+    const char* name;
+    size_t argc;
+    size_t function;        // Index of the function argument
+    size_t functionArgc;    // Arguments it is called with
+};
+
+const HigherOrderBuiltin higherOrderBuiltins[] = {
+    {"map", 2, 0, 1}, {"filter", 2, 0, 1}, {"foldl", 3, 0, 2}, {"foldr", 3, 0, 2},
+    {"zipWith", 3, 0, 2}, {"sortBy", 2, 1, 2},
+};
+
+//! Adds the functions the expression calls to callees. Calls of functions passed as values
+//! are not known before they happen and add UNKNOWN to effects.
+void collectCalls(const Node* node, const GlobalScope& globalScope,
+                  std::vector<EffectAnalysis::Function>& callees, unsigned& effects)
+{
+    if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        callees.push_back({call->symbol, call->arguments.size()});
+
+        const FunctionDefinition* function = globalScope.findFunction(call->symbol, call->arguments.size());
+        for (const HigherOrderBuiltin &builtin : higherOrderBuiltins)
+        {
+            if (function && function->builtin && builtin.argc == call->arguments.size() &&
+                function->builtin->token.data == builtin.name)
+            {
+                const FunctionNameNode* name =
+                    dynamic_cast<const FunctionNameNode*>(call->arguments[builtin.function].get());
+                if (name)
+                {
+                    callees.push_back({name->value.asFunction(), builtin.functionArgc});
+                }
+                else
+                {
+                    effects |= EffectAnalysis::UNKNOWN;
+                }
+            }
+        }
+
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            collectCalls(arg.get(), globalScope, callees, effects);
+        }
+    }
+    else if (const ListLiteralNode* list = dynamic_cast<const ListLiteralNode*>(node))
+    {
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            collectCalls(item.get(), globalScope, callees, effects);
+        }
+    }
+    // The rewritten nodes fall back to the original expression, which calls at least the
+    // same functions
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        collectCalls(inlined->original.get(), globalScope, callees, effects);
+    }
+    else if (const ConstantNode* constant = dynamic_cast<const ConstantNode*>(node))
+    {
+        collectCalls(constant->original.get(), globalScope, callees, effects);
+    }
+    else if (const FusedPipelineNode* fused = dynamic_cast<const FusedPipelineNode*>(node))
+    {
+        collectCalls(fused->original.get(), globalScope, callees, effects);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        collectCalls(arithmetic->original.get(), globalScope, callees, effects);
+    }
+}
+
+}
+
+void EffectAnalysis::define(const std::shared_ptr<FunctionDefinition>& definition, const GlobalScope& globalScope)
+{
+    const Function function(SymbolTable::intern(definition->token.data), definition->getArgc());
+    functions[function].definition = definition;
+    link(function, globalScope);
+
+    // Everything which may call the function has to be analysed again
+    std::vector<Function> pending(1, function);
+    std::set<Function> marked(pending.begin(), pending.end());
+    while (!pending.empty())
+    {
+        Info &info = functions[pending.back()];
+        pending.pop_back();
+
+        info.version = ++nextVersion;
+        if (!info.dirty)
+        {
+            info.dirty = true;
+            ++dirtyCount;
+        }
+
+        for (const Function &caller : info.callers)
+        {
+            if (marked.insert(caller).second)
+            {
+                pending.push_back(caller);
+            }
+        }
+    }
+}
+
+unsigned EffectAnalysis::effectsOf(const Function& function, const GlobalScope& globalScope)
+{
+    update(globalScope);
+
+    auto found = functions.find(function);
+
+    return found != functions.end() ? found->second.effects : UNKNOWN;
+}
+
+size_t EffectAnalysis::versionOf(const Function& function) const
+{
+    auto found = functions.find(function);
+
+    return found != functions.end() ? found->second.version : 0;
+}
+
+bool EffectAnalysis::isRecursive(const Function& function, const GlobalScope& globalScope)
+{
+    update(globalScope);
+
+    auto found = functions.find(function);
+
+    return found != functions.end() && found->second.recursive;
+}
+
+std::vector<EffectAnalysis::Function> EffectAnalysis::recursiveGroupOf(const Function& function,
+                                                                       const GlobalScope& globalScope)
+{
+    update(globalScope);
+
+    std::vector<Function> group;
+    auto found = functions.find(function);
+    if (found == functions.end() || !found->second.recursive)
+    {
+        return group;
+    }
+
+    for (const std::pair<const Function, Info> &entry : functions)
+    {
+        if (entry.second.definition && entry.second.group == found->second.group)
+        {
+            group.push_back(entry.first);
+        }
+    }
+
+    return group;
+}
+
+std::vector<EffectAnalysis::Function> EffectAnalysis::userFunctions() const
+{
+    std::vector<Function> res;
+    for (const std::pair<const Function, Info> &entry : functions)
+    {
+        if (entry.second.definition && !entry.second.definition->builtin)
+        {
+            res.push_back(entry.first);
+        }
+    }
+
+    std::sort(res.begin(), res.end(), [](const Function &fst, const Function &snd)
+    {
+        const std::string &fstName = SymbolTable::name(fst.first), &sndName = SymbolTable::name(snd.first);
+        return fstName < sndName || (fstName == sndName && fst.second < snd.second);
+    });
+
+    return res;
+}
+
+std::string EffectAnalysis::describe(unsigned effects)
+{
+    static const std::pair<Effect, const char*> names[] = {
+        {READS_INPUT, "reads-input"}, {WRITES_OUTPUT, "writes-output"}, {UNKNOWN, "unknown"},
+    };
+
+    std::string res;
+    for (const std::pair<Effect, const char*> &name : names)
+    {
+        if (effects & name.first)
+        {
+            res += (res.empty() ? "" : ", ") + std::string(name.second);
+        }
+    }
+
+    return res.empty() ? "pure" : res;
+}
+
+void EffectAnalysis::link(const Function& function, const GlobalScope& globalScope)
+{
+    Info &info = functions[function];
+
+    for (const Function &callee : info.callees)
+    {
+        functions[callee].callers.erase(function);
+    }
+    info.callees.clear();
+    info.ownEffects = PURE;
+
+    if (info.definition->builtin)
+    {
+        const std::string &name = info.definition->builtin->token.data;
+        info.ownEffects = name == "read" ? READS_INPUT : name == "write" ? WRITES_OUTPUT : PURE;
+    }
+    else
+    {
+        collectCalls(info.definition->definition.get(), globalScope, info.callees, info.ownEffects);
+        std::sort(info.callees.begin(), info.callees.end());
+        info.callees.erase(std::unique(info.callees.begin(), info.callees.end()), info.callees.end());
+    }
+
+    for (const Function &callee : info.callees)
+    {
+        functions[callee].callers.insert(function);
+    }
+}
+
+void EffectAnalysis::update(const GlobalScope& globalScope)
+{
+    if (!dirtyCount)
+    {
+        return;
+    }
+
+    std::vector<Function> dirty;
+    for (std::pair<const Function, Info> &entry : functions)
+    {
+        if (entry.second.dirty)
+        {
+            dirty.push_back(entry.first);
+        }
+    }
+
+    // The callees of a higher-order builtin change when it is redefined
+    for (const Function &function : dirty)
+    {
+        link(function, globalScope);
+    }
+
+    std::vector<Function> stack;
+    size_t index = 0;
+    for (const Function &function : dirty)
+    {
+        if (!functions[function].index)
+        {
+            connect(function, stack, index);
+        }
+    }
+
+    for (const Function &function : dirty)
+    {
+        Info &info = functions[function];
+        info.dirty = false;
+        info.index = 0;
+    }
+    dirtyCount = 0;
+}
+
+void EffectAnalysis::connect(const Function& function, std::vector<Function>& stack, size_t& index)
+{
+    Info &info = functions[function];
+    info.index = info.lowLink = ++index;
+    stack.push_back(function);
+    info.onStack = true;
+
+    // The functions which are not dirty keep their effects
+    for (const Function &callee : info.callees)
+    {
+        Info &calleeInfo = functions[callee];
+        if (!calleeInfo.dirty)
+        {
+            continue;
+        }
+        else if (!calleeInfo.index)
+        {
+            connect(callee, stack, index);
+            info.lowLink = std::min(info.lowLink, calleeInfo.lowLink);
+        }
+        else if (calleeInfo.onStack)
+        {
+            info.lowLink = std::min(info.lowLink, calleeInfo.index);
+        }
+    }
+
+    if (info.lowLink != info.index)
+    {
+        return;
+    }
+
+    // function is the root of a component, which is on the stack above it
+    const size_t group = ++nextGroup;
+    std::vector<Function> members;
+    do
+    {
+        members.push_back(stack.back());
+        stack.pop_back();
+        Info &member = functions[members.back()];
+        member.onStack = false;
+        member.group = group;
+    } while (members.back() != function);
+
+    unsigned effects = PURE;
+    bool recursive = members.size() > 1;
+    for (const Function &member : members)
+    {
+        const Info &memberInfo = functions[member];
+        effects |= memberInfo.ownEffects;
+
+        for (const Function &callee : memberInfo.callees)
+        {
+            const Info &calleeInfo = functions[callee];
+            effects |= calleeInfo.group == group ? PURE : calleeInfo.effects;
+            recursive = recursive || callee == function;
+        }
+    }
+
+    for (const Function &member : members)
+    {
+        Info &memberInfo = functions[member];
+        memberInfo.effects = effects;
+        memberInfo.recursive = recursive;
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+struct Node;
+struct FunctionDefinition;
+struct GlobalScope;
+
+//! Effects of the functions of a GlobalScope, computed over their call graph. The functions
+//! which call each other recursively form a strongly connected component of the graph and
+//! share their effects. A (re)definition marks only the function and its transitive callers
+//! to be analysed again, on the next query.
+class EffectAnalysis
+{
+public:
+    //! Flags of what a call may do besides computing its result
+    enum Effect : unsigned
+    {
+        PURE = 0,
+        READS_INPUT = 1,
+        WRITES_OUTPUT = 2,
+        UNKNOWN = 4,    // Calls a function which is not defined or passed as a value
+    };
+
+    //! Interned name and argument count
+    typedef std::pair<size_t, size_t> Function;
+
+    //! Records the (re)definition of a function, which is already stored in globalScope
+    void define(const std::shared_ptr<FunctionDefinition>& definition, const GlobalScope& globalScope);
+
+    //! Effects of calling function, UNKNOWN if it is not defined
+    unsigned effectsOf(const Function& function, const GlobalScope& globalScope);
+
+    //! Changes whenever function or a function it may call is (re)defined
+    size_t versionOf(const Function& function) const;
+
+    //! True if function may call itself, directly or through other functions
+    bool isRecursive(const Function& function, const GlobalScope& globalScope);
+
+    //! The functions which function is mutually recursive with, including itself. Empty if
+    //! function is not recursive.
+    std::vector<Function> recursiveGroupOf(const Function& function, const GlobalScope& globalScope);
+
+    //! The user defined functions in order of their names
+    std::vector<Function> userFunctions() const;
+
+    //! E.g. "pure" or "reads-input, writes-output"
+    static std::string describe(unsigned effects);
+
+private:
+    struct Info
+    {
+        //! Null for functions which are called but not defined
+        std::shared_ptr<FunctionDefinition> definition;
+        std::vector<Function> callees;
+        std::set<Function> callers;
+        //! Effects of the body itself, without the callees
+        unsigned ownEffects = UNKNOWN;
+        unsigned effects = UNKNOWN;
+        size_t version = 0;
+        //! Strongly connected component, valid when the function is not dirty
+        size_t group = 0;
+        bool recursive = false;
+        bool dirty = false;
+        // State of Tarjan's algorithm
+        size_t index = 0;
+        size_t lowLink = 0;
+        bool onStack = false;
+    };
+
+    std::map<Function, Info> functions;
+    size_t dirtyCount = 0;
+    size_t nextVersion = 0;
+    size_t nextGroup = 0;
+
+    //! Recomputes the callees and own effects of function from its body
+    void link(const Function& function, const GlobalScope& globalScope);
+    //! Analyses the dirty functions again
+    void update(const GlobalScope& globalScope);
+    void connect(const Function& function, std::vector<Function>& stack, size_t& index);
+
+};
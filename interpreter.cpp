@@ -1,124 +1,312 @@
 #include "interpreter.h"
 #include "parser.h"
-
+#include "vm.h"
+#include "optimizer.h"
+#include "kernels.h"
+#include "memo.h"
+#include "type_inference.h"
+
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <stdexcept>
+#include <thread>
+
+#if defined(__linux__) && defined(__GNUC__)
+#include <pthread.h>
+#endif
+
+
+size_t GlobalScope::nextEpoch() noexcept
+{
+    static size_t counter = 0;
 
+    return ++counter;
+}
 
-bool GlobalScope::isFunctionDefined(const std::string& name, size_t argc)
+bool GlobalScope::isFunctionDefined(const std::string& name, size_t argc) const
 {
-    return definitions.find(name) != definitions.end() &&
-           definitions[name].find(argc) != definitions[name].end();
+    return findFunction(SymbolTable::intern(name), argc) != nullptr;
 }
 
-std::shared_ptr<Value> GlobalScope::callFunction(const std::string& name, FunctionScope& fncScp)
+Value GlobalScope::callFunction(size_t symbol, FunctionScope& fncScp) const
 {
-    if (!isFunctionDefined(name, fncScp.paramCount()))
+    const FunctionDefinition* function = findFunction(symbol, fncScp.paramCount());
+    if (!function)
     {
         throw std::runtime_error("Called function which is not defined");
     }
 
-    return definitions[name][fncScp.paramCount()]->definition->eval(fncScp);
+    return function->definition->eval(fncScp);
 }
 
 bool GlobalScope::addFunction(std::shared_ptr<FunctionDefinition> definition)
 {
+    size_t symbol = SymbolTable::intern(definition->token.data);
     size_t argc = definition->getArgc();
-    bool isDefinded = isFunctionDefined(definition->token.data, argc);
+    const FunctionDefinition* previous = findFunction(symbol, argc);
+    bool isDefinded = previous != nullptr;
+
+    if (previous && previous->builtin)
+    {
+        ++libraryVersion;
+    }
+
+    if (symbol >= definitions.size())
+    {
+        definitions.resize(symbol + 1);
+    }
+    if (argc >= definitions[symbol].size())
+    {
+        definitions[symbol].resize(argc + 1);
+    }
 
-	definitions[definition->token.data][argc] = definition;
+	definitions[symbol][argc] = definition;
+    epoch = nextEpoch();
+    effectAnalysis.define(definition, *this);
 
 	return isDefinded;
 }
 
-std::shared_ptr<Value> FunctionScope::nth(size_t idx) const
+Value GlobalScope::evaluate(const std::shared_ptr<Node>& ast, FunctionScope& fncScp)
 {
-    if (idx >= parameters.size())
+    std::shared_ptr<Node> optimized = Optimizer::optimize(ast, *this);
+
+    if (engine == Engine::BYTECODE)
     {
-        throw std::runtime_error(
-            "Referencing formal parameter with index outside range of formal "
-            "parameter indexes!");
+        return VirtualMachine::evaluate(optimized, fncScp);
     }
 
-    return parameters[idx]->eval(*parentScope);
+    return optimized->eval(fncScp);
 }
 
-std::shared_ptr<Value> FunctionScope::headOfList() const
+Value GlobalScope::call(const FunctionDefinition& function, FunctionScope& fncScp)
 {
-    if (parameters.empty())
+    std::shared_ptr<MemoTable> memo = memoOf(function);
+    MemoTable::Key key;
+    if (memo)
     {
-        throw std::runtime_error("head() with no parameters given");
+        key = MemoTable::keyOf(fncScp);
+        if (Value res = memo->find(key))
+        {
+            return res;
+        }
     }
 
-    std::shared_ptr<ListLiteralNode> l = std::dynamic_pointer_cast<ListLiteralNode>(parameters[0]);
-    if (l)
+    Value res = engine == Engine::BYTECODE ? VirtualMachine::call(function, fncScp)
+                                           : function.definition->eval(fncScp);
+    if (memo)
+    {
+        memo->insert(key, res);
+    }
+
+    return res;
+}
+
+TypeInference& GlobalScope::types() const
+{
+    if (!typeInference || typesEpoch != epoch)
+    {
+        typeInference = std::make_shared<TypeInference>(*this);
+        typesEpoch = epoch;
+    }
+
+    return *typeInference;
+}
+
+std::shared_ptr<MemoTable> GlobalScope::memoOf(const FunctionDefinition& function) const
+{
+    if (!memoization || function.builtin)
     {
-        return l->contents[0]->eval(*parentScope);
+        return nullptr;
     }
 
-    const std::shared_ptr<Value> fst = parameters[0]->eval(*parentScope);
+    return Memo::of(function, *this).table;
+}
+
+//! True if less than a safety margin of the native stack of the thread is left
+static bool isNativeStackLow()
+{
+#if defined(__linux__) && defined(__GNUC__)
+    // Enough for the deepest nesting of a single argument and the unwinding of the exception
+    static const size_t margin = 256 * 1024;
+    // The stack grows downwards, towards this address
+    static thread_local uintptr_t limit = []() -> uintptr_t
+    {
+        pthread_attr_t attr;
+        void *lowest;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        {
+            return 0;
+        }
+        const bool known = pthread_attr_getstack(&attr, &lowest, &size) == 0 && size > 2 * margin;
+        pthread_attr_destroy(&attr);
+
+        return known ? reinterpret_cast<uintptr_t>(lowest) + margin : 0;
+    }();
+    char here;
+
+    return reinterpret_cast<uintptr_t>(&here) < limit;
+#else
+    return false;
+#endif
+}
+
+void Thunk::evaluate()
+{
+    // Every argument whose value depends on another unevaluated argument nests one more
+    // native call, so long chains of them are cut off before they overflow the stack. The
+    // bytecode engine needs more stack per argument, so the stack left is checked as well.
+    static thread_local size_t nesting = 0;
+    if (nesting >= maxNesting || isNativeStackLow())
+    {
+        throw std::runtime_error("Maximum nesting of unevaluated arguments exceeded");
+    }
 
-    if (fst->type == Value::Type::LIST_LITERAL)
+    struct NestingGuard
     {
-		const std::shared_ptr<ListLiteralValue> lst = std::dynamic_pointer_cast<ListLiteralValue>(fst);
+        NestingGuard() { ++nesting; }
+        ~NestingGuard() { --nesting; }
+    } guard;
+
+    value = expression->eval(*scope);
+
+    // The value is cached, so neither the expression nor its scope is needed anymore
+    expression.reset();
+    scope.reset();
+}
+
+FunctionScope::~FunctionScope()
+{
+    // A chain of unevaluated arguments alternates between thunks and the scopes they
+    // point to. Releasing it recursively could overflow the stack, so the outermost
+    // destructor releases the chain one thunk at a time.
+    static thread_local std::vector<std::shared_ptr<Thunk>> released;
+    static thread_local bool releasing = false;
 
-        if (!lst->values.empty())
+    for (std::shared_ptr<Thunk> &thunk : thunks)
+    {
+        if (thunk.use_count() == 1)
         {
-            return lst->values.front();
+            released.push_back(std::move(thunk));
         }
+    }
 
-        throw std::runtime_error("Cannot get head of empty list!");
-        
+    if (releasing)
+    {
+        return;
     }
-    else if (fst->type == Value::Type::INFINITE_LIST)
+
+    releasing = true;
+    while (!released.empty())
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(
-			std::dynamic_pointer_cast<InfiniteListValue>(fst)->first
-		));
+        std::shared_ptr<Thunk> thunk = std::move(released.back());
+        released.pop_back();
     }
+    releasing = false;
+}
 
-	throw std::runtime_error("Typing error: the argument to head() must be a list!");
+void FunctionScope::throwOutOfRange()
+{
+    throw std::runtime_error(
+        "Referencing formal parameter with index outside range of formal "
+        "parameter indexes!");
+}
+
+Value FunctionScope::headOfList() const
+{
+    if (thunks.empty())
+    {
+        throw std::runtime_error("head() with no parameters given");
+    }
+
+    // Only the first element of a list literal is evaluated
+    const Thunk &arg = *thunks[0];
+    std::shared_ptr<ListLiteralNode> l = std::dynamic_pointer_cast<ListLiteralNode>(arg.getExpression());
+    if (l && !l->contents.empty())
+    {
+        return l->contents[0]->eval(*arg.getScope());
+    }
+
+    return Builtins::head(thunks[0]->force());
 }
 
-std::shared_ptr<Value> FunctionScope::tailOfList() const
+Value FunctionScope::tailOfList() const
 {
-    if (parameters.empty())
+    if (thunks.empty())
     {
         throw std::runtime_error("tail() with no parameters given");
     }
 
-    std::shared_ptr<ListLiteralNode> l = std::dynamic_pointer_cast<ListLiteralNode>(parameters[0]);
+    // The first element of a list literal is never evaluated
+    const Thunk &arg = *thunks[0];
+    std::shared_ptr<ListLiteralNode> l = std::dynamic_pointer_cast<ListLiteralNode>(arg.getExpression());
     if (l)
     {
-        std::vector<std::shared_ptr<Value>> newVals;
+        std::vector<Value> newVals;
         for (size_t i = 1; i < l->contents.size(); ++i)
         {
-            newVals.push_back(l->contents[i]->eval(*parentScope));
+            newVals.push_back(l->contents[i]->eval(*arg.getScope()));
+        }
+
+        return Value::makeList<ListLiteralValue>(std::move(newVals));
+    }
+
+    return Builtins::tail(thunks[0]->force());
+}
+
+Value Builtins::head(const Value &fst)
+{
+    if (fst.getType() == Value::Type::LIST_LITERAL)
+    {
+        const ListLiteralValue &lst = fst.asList<ListLiteralValue>();
+
+        if (!lst.empty())
+        {
+            return lst[0];
         }
 
-        return std::dynamic_pointer_cast<Value>(std::make_shared<ListLiteralValue>(newVals));
+        throw std::runtime_error("Cannot get head of empty list!");
+        
+    }
+    else if (fst.getType() == Value::Type::INFINITE_LIST)
+    {
+        return Value::makeReal(fst.asList<InfiniteListValue>().first);
+    }
+    else if (fst.getType() == Value::Type::LIST_STREAM)
+    {
+        return fst.asList<StreamValue>().head();
     }
 
-    const std::shared_ptr<Value> fst = parameters[0]->eval(*parentScope);
+	throw std::runtime_error("Typing error: the argument to head() must be a list!");
+}
 
-    if (fst->type == Value::Type::LIST_LITERAL)
+Value Builtins::tail(const Value &fst)
+{
+    if (fst.getType() == Value::Type::LIST_LITERAL)
     {
-		std::vector<std::shared_ptr<Value>> &vals = std::dynamic_pointer_cast<ListLiteralValue>(fst)->values;
-        std::vector<std::shared_ptr<Value>> newVals;
-        for (size_t i = 1; i < vals.size(); ++i)
+        const ListLiteralValue &lst = fst.asList<ListLiteralValue>();
+
+        if (lst.empty())
         {
-            newVals.push_back(vals[i]);
+            return fst;
         }
 
-        return std::dynamic_pointer_cast<Value>(std::make_shared<ListLiteralValue>(newVals));
+        // The tail shares the elements of the list
+        return ListLiteralValue::slice(fst, 1, lst.size() - 1);
     }
-    else if (fst->type == Value::Type::INFINITE_LIST)
+    else if (fst.getType() == Value::Type::INFINITE_LIST)
     {
-        const std::shared_ptr<InfiniteListValue> lst = std::dynamic_pointer_cast<InfiniteListValue>(fst);
+        const InfiniteListValue &lst = fst.asList<InfiniteListValue>();
 
-        return std::dynamic_pointer_cast<Value>(std::make_shared<InfiniteListValue>(
-			lst->first + lst->difference, lst->difference
-		));
+        return Value::makeList<InfiniteListValue>(lst.first + lst.difference, lst.difference);
+    }
+    else if (fst.getType() == Value::Type::LIST_STREAM)
+    {
+        return fst.asList<StreamValue>().tail();
     }
 
 	throw std::runtime_error("Typing error: the argument to tail() must be a list!");
@@ -136,126 +324,107 @@ bool eqDouble(double fst, double snd)
     return false;
 }
 
-bool eqHelper(const std::shared_ptr<Value> fst, const std::shared_ptr<Value> snd)
+bool Builtins::equal(const Value &fst, const Value &snd)
 {
-    if (fst->type == Value::Type::LIST_LITERAL && fst->type == snd->type)
+    const Value::Type fstType = fst.getType();
+    const Value::Type sndType = snd.getType();
+
+    if (fstType == Value::Type::LIST_STREAM)
+    {
+        return equal(fst.asList<StreamValue>().materialize(), snd);
+    }
+    else if (sndType == Value::Type::LIST_STREAM)
+    {
+        return equal(fst, snd.asList<StreamValue>().materialize());
+    }
+
+    if (fstType == Value::Type::LIST_LITERAL && fstType == sndType)
     {
-        std::vector<std::shared_ptr<Value>> &fstVals = std::dynamic_pointer_cast<ListLiteralValue>(fst)->values;
-        std::vector<std::shared_ptr<Value>> &sndVals = std::dynamic_pointer_cast<ListLiteralValue>(snd)->values;
+        const ListLiteralValue &fstVals = fst.asList<ListLiteralValue>();
+        const ListLiteralValue &sndVals = snd.asList<ListLiteralValue>();
 
-        if (fstVals.size() != sndVals.size())
+        // The cached hashes tell most lists of different shapes apart in O(1)
+        if (fstVals.size() != sndVals.size() || fstVals.hash() != sndVals.hash())
         {
             return false;
         }
 
-        for (size_t i = 0; i < fstVals.size(); ++i)
-        {
-            if (!eqHelper(fstVals[i], sndVals[i]))
-            {
-                return false;
-            }
-        }
-
-        return true;
+        return ListLiteralValue::equalElements(fstVals, sndVals, equal);
     }
-    else if (fst->type == Value::Type::INFINITE_LIST && fst->type == snd->type)
+    else if (fstType == Value::Type::INFINITE_LIST && fstType == sndType)
     {
-        const std::shared_ptr<InfiniteListValue> f = std::dynamic_pointer_cast<InfiniteListValue>(fst);
-        const std::shared_ptr<InfiniteListValue> s = std::dynamic_pointer_cast<InfiniteListValue>(snd);
+        const InfiniteListValue &f = fst.asList<InfiniteListValue>();
+        const InfiniteListValue &s = snd.asList<InfiniteListValue>();
 
-        return eqDouble(f->first, s->first) && eqDouble(f->difference, s->difference);
+        return eqDouble(f.first, s.first) && eqDouble(f.difference, s.difference);
     }
-    else if (fst->type == Value::Type::INT_NUMBER && fst->type == snd->type)
+    else if (fstType == Value::Type::INT_NUMBER && fstType == sndType)
     {
-        return (std::dynamic_pointer_cast<IntValue>(fst)->value ==
-            std::dynamic_pointer_cast<IntValue>(snd)->value
-        );
+        return fst.asInt() == snd.asInt();
     }
-    else if (fst->type == Value::Type::REAL_NUMBER && fst->type == snd->type)
+    else if (fstType == Value::Type::FUNCTION && fstType == sndType)
     {
-        return eqDouble(std::dynamic_pointer_cast<RealValue>(fst)->value,
-            std::dynamic_pointer_cast<RealValue>(snd)->value
-        );
+        return fst.asFunction() == snd.asFunction();
     }
-    else if (fst->type == Value::Type::INFINITE_LIST || snd->type == Value::Type::INFINITE_LIST)
+    else if (fstType == Value::Type::REAL_NUMBER && fstType == sndType)
+    {
+        return eqDouble(fst.asReal(), snd.asReal());
+    }
+    else if (fstType == Value::Type::INFINITE_LIST || sndType == Value::Type::INFINITE_LIST)
     {
         return false;
     }
-    else if (fst->type == Value::Type::LIST_LITERAL)
+    else if (fstType == Value::Type::LIST_LITERAL)
     {
-        std::vector<std::shared_ptr<Value>> &fstVals = std::dynamic_pointer_cast<ListLiteralValue>(fst)->values;
+        const ListLiteralValue &fstVals = fst.asList<ListLiteralValue>();
 
         if (fstVals.size() != 1)
         {
             return false;
         }
 
-        return eqHelper(fstVals[0], snd);
+        return equal(fstVals[0], snd);
     }
-    else if (snd->type == Value::Type::LIST_LITERAL)
+    else if (sndType == Value::Type::LIST_LITERAL)
     {
-        std::vector<std::shared_ptr<Value>> &sndVals = std::dynamic_pointer_cast<ListLiteralValue>(snd)->values;
-        
+        const ListLiteralValue &sndVals = snd.asList<ListLiteralValue>();
+
         if (sndVals.size() != 1)
         {
             return false;
         }
 
-        return eqHelper(fst, sndVals[0]);
+        return equal(fst, sndVals[0]);
     }
     
-    double f, s;
-    if (fst->type == Value::Type::REAL_NUMBER && snd->type == Value::Type::INT_NUMBER)
+    if (fst.isNumber() && snd.isNumber())
     {
-        f = std::dynamic_pointer_cast<RealValue>(fst)->value;
-        s = std::dynamic_pointer_cast<IntValue>(snd)->value;
-
-        return eqDouble(f, s);
-    }
-    else if (fst->type == Value::Type::INT_NUMBER && snd->type == Value::Type::REAL_NUMBER)
-    {
-        f = std::dynamic_pointer_cast<IntValue>(fst)->value;
-        s = std::dynamic_pointer_cast<RealValue>(snd)->value;
-
-        return eqDouble(f, s);
+        return eqDouble(fst.asNumber(), snd.asNumber());
     }
 
     return false;
 }
 
-std::shared_ptr<Value> eqFunc(FunctionScope &fncScp)
+Value eqFunc(FunctionScope &fncScp)
 {
-    
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-    const std::shared_ptr<Value> snd = fncScp.nth(1);
+    const Value &fst = fncScp.nth(0);
+    const Value &snd = fncScp.nth(1);
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(eqHelper(fst, snd)));
+    return Value::makeInt(Builtins::equal(fst, snd));
 }
 
-std::shared_ptr<Value> leFunc(FunctionScope &fncScp)
+Value Builtins::le(const Value &fst, const Value &snd)
 {
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-    const std::shared_ptr<Value> snd = fncScp.nth(1);
-
-    if (fst->type == snd->type)
+    if (fst.getType() == snd.getType())
     {
-        switch (fst->type)
+        switch (fst.getType())
         {
 		case Value::Type::INT_NUMBER:
-		{
-			int fstVal = std::dynamic_pointer_cast<IntValue>(fst)->value;
-			int sndVal = std::dynamic_pointer_cast<IntValue>(snd)->value;
-			
-			return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(fstVal < sndVal));
-		}
+			return Value::makeInt(fst.asInt() < snd.asInt());
 		case Value::Type::REAL_NUMBER:
-		{
-			double fstVal = std::dynamic_pointer_cast<RealValue>(fst)->value;
-			double sndVal = std::dynamic_pointer_cast<RealValue>(snd)->value;
-			
-			return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(fstVal < sndVal));
-		}
+			return Value::makeInt(fst.asReal() < snd.asReal());
 		case Value::Type::LIST_LITERAL:
+		case Value::Type::LIST_STREAM:
 			throw std::runtime_error("Cannot compare 2 lists");
 		default:
 			throw std::runtime_error("Cannot determine if values of unknown type!");
@@ -265,124 +434,214 @@ std::shared_ptr<Value> leFunc(FunctionScope &fncScp)
     throw std::runtime_error("Cannot compare values of different types!");
 }
 
-std::shared_ptr<Value> nandFunc(FunctionScope &fncScp)
+Value leFunc(FunctionScope &fncScp)
+{
+    const Value &fst = fncScp.nth(0);
+    const Value &snd = fncScp.nth(1);
+
+    return Builtins::le(fst, snd);
+}
+
+bool Builtins::nandOperand(const Value &val)
 {
-	bool res;
+    switch (val.getType())
+    {
+    case Value::Type::INT_NUMBER:
+        return val.asInt();
+    case Value::Type::REAL_NUMBER:
+        return val.asReal();
+    case Value::Type::LIST_LITERAL:
+        return !val.asList<ListLiteralValue>().empty();
+    case Value::Type::INFINITE_LIST:
+    case Value::Type::LIST_STREAM:
+        return true;
+    default:
+        throw std::runtime_error("Cannot nand() unknown types!");
+    }
+}
 
+Value nandFunc(FunctionScope &fncScp)
+{
 	for (size_t i = 0; i < 2; ++i)
 	{
-        std::shared_ptr<Value> val = fncScp.nth(i);
-		switch (val->type)
-		{
-		case Value::Type::INT_NUMBER:
-		{
-			res = std::dynamic_pointer_cast<IntValue>(val)->value;
-		}
-			break;
-		case Value::Type::REAL_NUMBER:
-		{
-			res = std::dynamic_pointer_cast<RealValue>(val)->value;
-		}
-			break;
-		case Value::Type::LIST_LITERAL:
-		{
-			res = !std::dynamic_pointer_cast<ListLiteralValue>(val)->values.empty();
-		}
-			break;
-		case Value::Type::INFINITE_LIST:
-		{
-			res = true;
-		}
-			break;
-		default:
-			throw std::runtime_error("Cannot nand() unknown types!");
-        }
-
-        if (res == false)
+        if (!Builtins::nandOperand(fncScp.nth(i)))
         {
-            return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(1));
+            return Value::makeInt(1);
         }
 	}
 
-	return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(0));
+	return Value::makeInt(0);
 }
 
-std::shared_ptr<Value> lengthFunc(FunctionScope &fncScp)
+Value Builtins::length(const Value &fst)
 {
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-
-    if (fst->type != Value::Type::LIST_LITERAL)
+    if (fst.getType() == Value::Type::LIST_STREAM)
+    {
+        return length(fst.asList<StreamValue>().materialize());
+    }
+    else if (fst.getType() != Value::Type::LIST_LITERAL)
     {
-        if (fst->type == Value::Type::INFINITE_LIST)
+        if (fst.getType() == Value::Type::INFINITE_LIST)
         {
             throw std::runtime_error("Cannot determine length() of infinite list!");
         }
 
-		return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(-1));
+		return Value::makeInt(-1);
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(
-		int(std::dynamic_pointer_cast<ListLiteralValue>(fst)->values.size())
-	));
+    return Value::makeInt(fst.asList<ListLiteralValue>().size());
 }
 
-std::shared_ptr<Value> headFunc(FunctionScope &fncScp)
+Value lengthFunc(FunctionScope &fncScp)
+{
+    return Builtins::length(fncScp.nth(0));
+}
+
+Value headFunc(FunctionScope &fncScp)
 {
     return fncScp.headOfList();
 }
 
-std::shared_ptr<Value> tailFunc(FunctionScope &fncScp)
+Value tailFunc(FunctionScope &fncScp)
 {
     return fncScp.tailOfList();
 }
 
-std::shared_ptr<Value> concatFunc(FunctionScope &fncScp)
+//! Checks that val can be an argument to concat()
+static void checkFiniteList(const Value &val)
 {
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-    const std::shared_ptr<Value> snd = fncScp.nth(1);
-
-    if (fst->type != Value::Type::LIST_LITERAL || snd->type != Value::Type::LIST_LITERAL)
+    if (val.getType() != Value::Type::LIST_LITERAL && val.getType() != Value::Type::LIST_STREAM)
     {
         throw std::runtime_error(
             "Typing error: the arguments to concat must be finite lists! "
             "Cannot concat infinite lists for obvious reasons");
     }
+}
+
+Value Builtins::concat(const Value &fst, const Value &snd)
+{
+    checkFiniteList(fst);
+    checkFiniteList(snd);
 
-    std::vector<std::shared_ptr<Value>> &fstVals = std::dynamic_pointer_cast<ListLiteralValue>(fst)->values;
-    std::vector<std::shared_ptr<Value>> &sndVals = std::dynamic_pointer_cast<ListLiteralValue>(snd)->values;
+    if (fst.getType() == Value::Type::LIST_STREAM)
+    {
+        // The elements of snd follow when the rest of fst is computed
+        std::shared_ptr<StreamValue::Suspension> rest = fst.asList<StreamValue>().rest;
+        std::function<Value()> compute = [rest, snd]() { return concat(rest->force(), snd); };
 
-    for (std::shared_ptr<Value> val : sndVals)
+        return Value::makeList<StreamValue>(fst.asList<StreamValue>().prefix,
+                                            std::make_shared<StreamValue::Suspension>(std::move(compute)));
+    }
+    else if (snd.getType() == Value::Type::LIST_STREAM)
     {
-        fstVals.push_back(val);
+        if (fst.asList<ListLiteralValue>().empty())
+        {
+            return snd;
+        }
+
+        const StreamValue &stream = snd.asList<StreamValue>();
+
+        return Value::makeList<StreamValue>(ListLiteralValue::concat(fst, stream.prefix), stream.rest);
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<ListLiteralValue>(fstVals));
+    // The result shares the elements of both lists, which are never modified
+    return ListLiteralValue::concat(fst, snd);
 }
 
-std::shared_ptr<Value> ifFunc(FunctionScope &fncScp)
+Value Builtins::lazyConcat(const Value &fst, const std::shared_ptr<Thunk> &snd)
 {
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-    bool condition;
+    checkFiniteList(fst);
+
+    std::function<Value()> compute;
+    Value prefix;
 
-    if (fst->type == Value::Type::INT_NUMBER)
+    if (fst.getType() == Value::Type::LIST_STREAM)
     {
-        condition = std::dynamic_pointer_cast<IntValue>(fst)->value;
+        std::shared_ptr<StreamValue::Suspension> rest = fst.asList<StreamValue>().rest;
+        compute = [rest, snd]() { return lazyConcat(rest->force(), snd); };
+        prefix = fst.asList<StreamValue>().prefix;
     }
-    else if (fst->type == Value::Type::REAL_NUMBER)
+    else if (!fst.asList<ListLiteralValue>().empty())
     {
-        condition = std::dynamic_pointer_cast<RealValue>(fst)->value;
+        compute = [snd]()
+        {
+            const Value &val = snd->force();
+            checkFiniteList(val);
+
+            return val;
+        };
+        prefix = fst;
     }
-    else if (fst->type == Value::Type::LIST_LITERAL)
+    else
     {
-        condition = !std::dynamic_pointer_cast<ListLiteralValue>(fst)->values.empty();
+        return concat(fst, snd->force());
     }
-    else
+
+    return Value::makeList<StreamValue>(prefix, std::make_shared<StreamValue::Suspension>(std::move(compute)));
+}
+
+bool Builtins::isLazyRest(const Node *snd, const GlobalScope &globalScope)
+{
+    // Inlined functions are not recursive, but the original call is evaluated once they are redefined
+    if (const InlinedNode *inlined = dynamic_cast<const InlinedNode*>(snd))
     {
-        throw std::runtime_error(
-            "Typing error: the condition of if must be a number - int, real or list literal!");
+        snd = inlined->original.get();
+    }
+
+    const FunctionApplication *call = dynamic_cast<const FunctionApplication*>(snd);
+    if (!call)
+    {
+        return false;
+    }
+
+    const FunctionDefinition *function = globalScope.findFunction(call->symbol, call->arguments.size());
+    const EffectAnalysis::Function key(call->symbol, call->arguments.size());
+
+    return function && !function->builtin && globalScope.effects().isRecursive(key, globalScope) &&
+        globalScope.effects().effectsOf(key, globalScope) == EffectAnalysis::PURE;
+}
+
+Value concatFunc(FunctionScope &fncScp)
+{
+    const Value &fst = fncScp.nth(0);
+
+    // A list built by recursion, like concat([x], f(tail(#0))), is computed only as far as it is used
+    std::shared_ptr<Thunk> snd = fncScp.getThunk(1);
+    if (Builtins::isLazyRest(snd->getExpression().get(), fncScp.getGlobalScope()))
+    {
+        return Builtins::lazyConcat(fst, snd);
+    }
+
+    return Builtins::concat(fst, fncScp.nth(1));
+}
+
+bool Builtins::condition(const Value &fst)
+{
+    if (fst.getType() == Value::Type::INT_NUMBER)
+    {
+        return fst.asInt();
+    }
+    else if (fst.getType() == Value::Type::REAL_NUMBER)
+    {
+        return fst.asReal();
+    }
+    else if (fst.getType() == Value::Type::LIST_LITERAL)
+    {
+        return !fst.asList<ListLiteralValue>().empty();
+    }
+    else if (fst.getType() == Value::Type::LIST_STREAM)
+    {
+        // Streams always start with a non-empty prefix
+        return true;
     }
 
-    if (condition)
+    throw std::runtime_error(
+        "Typing error: the condition of if must be a number - int, real or list literal!");
+}
+
+Value ifFunc(FunctionScope &fncScp)
+{
+    if (Builtins::condition(fncScp.nth(0)))
     {
         return fncScp.nth(1);
     }
@@ -390,7 +649,7 @@ std::shared_ptr<Value> ifFunc(FunctionScope &fncScp)
     return fncScp.nth(2);
 }
 
-std::shared_ptr<Value> readFunc(FunctionScope &fncScp)
+Value Builtins::read()
 {
     std::string input;
     std::cout << "> read(): ";
@@ -433,256 +692,189 @@ std::shared_ptr<Value> readFunc(FunctionScope &fncScp)
 
     if (decimal)
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(
-            std::stod(word)
-        ));
+        return Value::makeReal(std::stod(word));
     }
     
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(
-        std::stoi(word)
-    ));
+    return Value::makeInt(std::stoll(word));
+}
+
+Value readFunc(FunctionScope &fncScp)
+{
+    return Builtins::read();
 }
 
-std::shared_ptr<Value> writeFunc(FunctionScope &fncScp)
+Value writeFunc(FunctionScope &fncScp)
 {
     try
     {
-        std::cout << fncScp.nth(0)->toString() << std::endl;
-        return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(0));
+        std::cout << fncScp.nth(0).toString() << std::endl;
+        return Value::makeInt(0);
     }
     catch (...)
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(1));
+        return Value::makeInt(1);
     }
 }
 
-std::shared_ptr<Value> intFunc(FunctionScope &fncScp)
+Value Builtins::toInt(const Value &fst)
 {
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-
-    if (fst->type == Value::Type::INT_NUMBER)
+    if (fst.getType() == Value::Type::INT_NUMBER)
     {
         return fst;
     }
 
-    if (fst->type != Value::Type::REAL_NUMBER)
+    if (fst.getType() != Value::Type::REAL_NUMBER)
     {
         throw std::runtime_error("Typing error: the argument to int() must be a real number!");
     }
 
-    double res = std::dynamic_pointer_cast<RealValue>(fst)->value;
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(trunc(res)));
+    return Value::makeInt(trunc(fst.asReal()));
 }
 
-std::shared_ptr<Value> addFunc(FunctionScope &fncScp)
+Value intFunc(FunctionScope &fncScp)
 {
-    std::shared_ptr<Value> vals[2] = {fncScp.nth(0), fncScp.nth(1)};
-    double res = 0;
-    bool isDouble = false;
+    return Builtins::toInt(fncScp.nth(0));
+}
 
-    for (size_t i = 0; i < 2; ++i)
+Value Builtins::add(const Value &fst, const Value &snd)
+{
+    // Ints stay exact beyond 2^53, only mixed operands are computed as reals
+    if (fst.getType() == Value::Type::INT_NUMBER && snd.getType() == Value::Type::INT_NUMBER)
     {
-        if (vals[i]->type == Value::Type::REAL_NUMBER)
-        {
-            res += std::dynamic_pointer_cast<RealValue>(vals[i])->value;
-            isDouble = true;
-        }
-        else if (vals[i]->type == Value::Type::INT_NUMBER)
-        {
-            res += std::dynamic_pointer_cast<IntValue>(vals[i])->value;
-        }
-        else
-        {
-            throw std::runtime_error(
-                "Typing error: the arguments to add() must be numbers - int or real!");
-        }
+        return Value::makeInt(add(fst.asInt(), snd.asInt()));
     }
-
-    if (isDouble)
+    else if (!fst.isNumber() || !snd.isNumber())
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(res));
+        throw std::runtime_error(
+            "Typing error: the arguments to add() must be numbers - int or real!");
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(trunc(res)));
+    return Value::makeReal(fst.asNumber() + snd.asNumber());
 }
 
-std::shared_ptr<Value> subFunc(FunctionScope &fncScp)
+Value Builtins::sub(const Value &fst, const Value &snd)
 {
-    std::shared_ptr<Value> vals[2] = {fncScp.nth(0), fncScp.nth(1)};
-    double res = 0;
-    bool isDouble = false;
-
-    for (int i = 0; i < 2; ++i)
+    // Ints stay exact beyond 2^53, only mixed operands are computed as reals
+    if (fst.getType() == Value::Type::INT_NUMBER && snd.getType() == Value::Type::INT_NUMBER)
     {
-        if (vals[i]->type == Value::Type::REAL_NUMBER)
-        {
-            res += (std::dynamic_pointer_cast<RealValue>(vals[i])->value * (1 - 2 * i));
-            isDouble = true;
-        }
-        else if (vals[i]->type == Value::Type::INT_NUMBER)
-        {
-            res += (std::dynamic_pointer_cast<IntValue>(vals[i])->value * (1 - 2 * i));
-        }
-        else
-        {
-            throw std::runtime_error(
-                "Typing error: the arguments to sub() must be numbers - int or real!");
-        }
+        return Value::makeInt(sub(fst.asInt(), snd.asInt()));
     }
-
-    if (isDouble)
+    else if (!fst.isNumber() || !snd.isNumber())
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(res));
+        throw std::runtime_error(
+            "Typing error: the arguments to sub() must be numbers - int or real!");
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(trunc(res)));
+    return Value::makeReal(fst.asNumber() - snd.asNumber());
 }
 
-std::shared_ptr<Value> mulFunc(FunctionScope &fncScp)
+Value Builtins::mul(const Value &fst, const Value &snd)
 {
-    std::shared_ptr<Value> vals[2] = {fncScp.nth(0), fncScp.nth(1)};
-    double res = 1.0;
-    bool isDouble = false;
-
-    for (size_t i = 0; i < 2; ++i)
+    // Ints stay exact beyond 2^53, only mixed operands are computed as reals
+    if (fst.getType() == Value::Type::INT_NUMBER && snd.getType() == Value::Type::INT_NUMBER)
     {
-        if (vals[i]->type == Value::Type::REAL_NUMBER)
-        {
-            res *= std::dynamic_pointer_cast<RealValue>(vals[i])->value;
-            isDouble = true;
-        }
-        else if (vals[i]->type == Value::Type::INT_NUMBER)
-        {
-            res *= std::dynamic_pointer_cast<IntValue>(vals[i])->value;
-        }
-        else
-        {
-            throw std::runtime_error(
-                "Typing error: the arguments to mul() must be numbers - int or real!");
-        }
+        return Value::makeInt(mul(fst.asInt(), snd.asInt()));
     }
-
-    if (isDouble)
+    else if (!fst.isNumber() || !snd.isNumber())
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(res));
+        throw std::runtime_error(
+            "Typing error: the arguments to mul() must be numbers - int or real!");
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(trunc(res)));
+    return Value::makeReal(fst.asNumber() * snd.asNumber());
 }
 
-std::shared_ptr<Value> divFunc(FunctionScope &fncScp)
+Value Builtins::div(const Value &fst, const Value &snd)
 {
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-    const std::shared_ptr<Value> snd = fncScp.nth(1);
-
-    if ((fst->type != Value::Type::REAL_NUMBER &&
-         fst->type != Value::Type::INT_NUMBER) ||
-        (snd->type != Value::Type::REAL_NUMBER &&
-         snd->type != Value::Type::INT_NUMBER))
+    if (!fst.isNumber() || !snd.isNumber())
     {
         throw std::runtime_error(
             "Typing error: the arguments to div() must be numbers - int or real!");
     }
 
-    if (fst->type == Value::Type::REAL_NUMBER)
+    if (fst.getType() == Value::Type::INT_NUMBER && snd.getType() == Value::Type::INT_NUMBER)
     {
-        double fstVal = std::dynamic_pointer_cast<RealValue>(fst)->value;
-
-        if (snd->type == Value::Type::REAL_NUMBER)
-        {
-            double sndVal = std::dynamic_pointer_cast<RealValue>(snd)->value;
-            if (sndVal == 0.0)
-            {
-                throw std::runtime_error("Division by zero!");
-            }
-            return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(fstVal / sndVal));
-        }
-
-        int sndVal = std::dynamic_pointer_cast<IntValue>(snd)->value;
-        if (sndVal == 0)
+        if (snd.asInt() == 0)
         {
             throw std::runtime_error("Division by zero!");
         }
-
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(fstVal / sndVal));
-    }
-
-    int fstVal = std::dynamic_pointer_cast<IntValue>(fst)->value;
-    if (snd->type == Value::Type::REAL_NUMBER)
-    {
-        double sndVal = std::dynamic_pointer_cast<RealValue>(snd)->value;
-        if (sndVal == 0.0)
+        else if (snd.asInt() == -1)
         {
-            throw std::runtime_error("Division by zero!");
+            // The minimum divided by -1 overflows, negate it with wraparound instead
+            return Value::makeInt(sub(int64_t(0), fst.asInt()));
         }
 
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(fstVal / sndVal));
+        return Value::makeInt(fst.asInt() / snd.asInt());
     }
-    
-    int sndVal = std::dynamic_pointer_cast<IntValue>(snd)->value;
-    if (sndVal == 0)
+
+    double sndVal = snd.asNumber();
+    if (sndVal == 0.0)
     {
         throw std::runtime_error("Division by zero!");
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(fstVal / sndVal));
+    return Value::makeReal(fst.asNumber() / sndVal);
 }
 
-std::shared_ptr<Value> modFunc(FunctionScope &fncScp)
+Value Builtins::mod(const Value &fst, const Value &snd)
 {
-    const std::shared_ptr<Value> fst = fncScp.nth(0);
-    const std::shared_ptr<Value> snd = fncScp.nth(1);
-
-    if (fst->type != Value::Type::INT_NUMBER || snd->type != Value::Type::INT_NUMBER)
+    if (fst.getType() != Value::Type::INT_NUMBER || snd.getType() != Value::Type::INT_NUMBER)
     {
         throw std::runtime_error("Typing error: the arguments to mod() must be int values!");
     }
 
-    int fstVal = std::dynamic_pointer_cast<IntValue>(fst)->value;
-    int sndVal = std::dynamic_pointer_cast<IntValue>(snd)->value;
-
-    if (sndVal == 0)
+    if (snd.asInt() == 0)
     {
         throw std::runtime_error("Modulo division by zero!");
     }
+    else if (snd.asInt() == -1)
+    {
+        // Avoids the overflow of the minimum divided by -1
+        return Value::makeInt(0);
+    }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(fstVal % sndVal));
+    return Value::makeInt(fst.asInt() % snd.asInt());
 }
 
-std::shared_ptr<Value> list1Func(FunctionScope &fncScp)
+Value Builtins::list(const Value &val)
 {
-    std::shared_ptr<Value> val = fncScp.nth(0);
-
-    if (val->type == Value::Type::REAL_NUMBER)
+    if (val.isNumber())
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<InfiniteListValue>(
-            std::dynamic_pointer_cast<RealValue>(val)->value, 1
-        ));
+        return Value::makeList<InfiniteListValue>(val.asNumber(), 1);
     }
-    else if (val->type == Value::Type::INT_NUMBER)
+
+    throw std::runtime_error("Typing error: the arguments to list() must be numbers!");
+}
+
+Value Builtins::list(const Value &first, const Value &difference)
+{
+    const Value *vals[2] = {&first, &difference};
+
+    if (!vals[0]->isNumber() || !vals[1]->isNumber())
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<InfiniteListValue>(
-            std::dynamic_pointer_cast<IntValue>(val)->value, 1
-        ));
+        throw std::runtime_error("Typing error: the arguments to list() must be numbers!");
     }
 
-    throw std::runtime_error("Typing error: the arguments to list() must be numbers!");
+    return Value::makeList<InfiniteListValue>(vals[0]->asNumber(), vals[1]->asNumber());
 }
 
-std::shared_ptr<Value> list2Func(FunctionScope &fncScp)
+Value Builtins::list(const Value &first, const Value &difference, const Value &count)
 {
-    std::shared_ptr<Value> vals[2] = {fncScp.nth(0), fncScp.nth(1)};
+    const Value *vals[3] = {&first, &difference, &count};
+    bool isDouble = false;
     double res[2];
+    int64_t size;
 
     for (size_t i = 0; i < 2; ++i)
     {
-        if (vals[i]->type == Value::Type::REAL_NUMBER)
+        if (vals[i]->getType() == Value::Type::REAL_NUMBER)
         {
-            res[i] = std::dynamic_pointer_cast<RealValue>(vals[i])->value;
+            isDouble = true;
+            res[i] = vals[i]->asReal();
         }
-        else if (vals[i]->type == Value::Type::INT_NUMBER)
+        else if (vals[i]->getType() == Value::Type::INT_NUMBER)
         {
-            res[i] = std::dynamic_pointer_cast<IntValue>(vals[i])->value;
+            res[i] = vals[i]->asInt();
         }
         else
         {
@@ -690,98 +882,1036 @@ std::shared_ptr<Value> list2Func(FunctionScope &fncScp)
         }
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<InfiniteListValue>(res[0], res[1]));
+    if (vals[2]->getType() != Value::Type::INT_NUMBER)
+    {
+        throw std::runtime_error("Typing error: #2 for list() should be int!");
+    }
+    size = std::max<int64_t>(vals[2]->asInt(), 0);
+
+    // The elements are computed on access, so the range is never stored. Ints are kept
+    // exact, so the elements agree with sum() beyond 2^53.
+    if (isDouble)
+    {
+        return Value::makeList<ListLiteralValue>(res[0], res[1], static_cast<size_t>(size));
+    }
+
+    return Value::makeList<ListLiteralValue>(first.asInt(), difference.asInt(), static_cast<size_t>(size));
 }
 
-std::shared_ptr<Value> list3Func(FunctionScope &fncScp)
+Value Builtins::sqrt(const Value &fst)
 {
-    std::shared_ptr<Value> vals[3] = {fncScp.nth(0), fncScp.nth(1), fncScp.nth(2)};
-    bool isDouble = false;;
-    double res[2];
-    int size;
+    if (fst.isNumber())
+    {
+        return Value::makeReal(std::sqrt(fst.asNumber()));
+    }
+    
+    throw std::runtime_error("Typing error: the arguments to sqrt() must be a number!");
+}
 
-    for (size_t i = 0; i < 2; ++i)
+Value addFunc(FunctionScope &fncScp)
+{
+    return Builtins::add(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value subFunc(FunctionScope &fncScp)
+{
+    return Builtins::sub(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value mulFunc(FunctionScope &fncScp)
+{
+    return Builtins::mul(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value divFunc(FunctionScope &fncScp)
+{
+    return Builtins::div(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value modFunc(FunctionScope &fncScp)
+{
+    return Builtins::mod(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value list1Func(FunctionScope &fncScp)
+{
+    return Builtins::list(fncScp.nth(0));
+}
+
+Value list2Func(FunctionScope &fncScp)
+{
+    return Builtins::list(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value list3Func(FunctionScope &fncScp)
+{
+    return Builtins::list(fncScp.nth(0), fncScp.nth(1), fncScp.nth(2));
+}
+
+Value sqrtFunc(FunctionScope &fncScp)
+{
+    return Builtins::sqrt(fncScp.nth(0));
+}
+
+FunctionCaller::FunctionCaller(GlobalScope &globalScope, const Value &function, size_t argc, const char *caller)
+    : globalScope(globalScope)
+{
+    if (function.getType() != Value::Type::FUNCTION)
+    {
+        throw std::runtime_error(std::string("Typing error: the first argument to ") + caller +
+                                 "() must be the name of a function!");
+    }
+
+    definition = globalScope.findFunction(function.asFunction(), argc);
+    if (!definition)
     {
-        if (vals[i]->type == Value::Type::REAL_NUMBER)
+        throw std::runtime_error(std::string("Called function which is not defined: ") +
+                                 function.toString() + "/" + std::to_string(argc));
+    }
+}
+
+Value FunctionCaller::operator()(const Value &fst)
+{
+    return call(&fst, 1);
+}
+
+Value FunctionCaller::operator()(const Value &fst, const Value &snd)
+{
+    const Value values[2] = {fst, snd};
+
+    return call(values, 2);
+}
+
+Value FunctionCaller::call(const Value *values, size_t count)
+{
+    // Most calls keep no reference to their scope, so one scope serves every element
+    if (!scope || scope.use_count() != 1 || !scope->reuse(values, count))
+    {
+        std::vector<std::shared_ptr<Thunk>> thunks;
+        thunks.reserve(count);
+        for (size_t i = 0; i < count; ++i)
         {
-            isDouble = true;
-            res[i] = std::dynamic_pointer_cast<RealValue>(vals[i])->value;
+            thunks.push_back(std::make_shared<Thunk>(values[i]));
         }
-        else if (vals[i]->type == Value::Type::INT_NUMBER)
+
+        scope = std::make_shared<FunctionScope>(globalScope, std::move(thunks));
+    }
+
+    return globalScope.call(*definition, *scope);
+}
+
+Value Builtins::finiteList(const Value &lst, const char *caller)
+{
+    if (lst.getType() == Value::Type::LIST_STREAM)
+    {
+        return lst.asList<StreamValue>().materialize();
+    }
+    else if (lst.getType() != Value::Type::LIST_LITERAL)
+    {
+        throw std::runtime_error(std::string("Typing error: the list argument to ") + caller +
+                                 "() must be a finite list!");
+    }
+
+    return lst;
+}
+
+//! Returns the int argument of caller(), argument names it in errors
+static int64_t intArgument(const Value &val, const char *argument, const char *caller)
+{
+    if (val.getType() != Value::Type::INT_NUMBER)
+    {
+        throw std::runtime_error(std::string("Typing error: ") + argument + " for " + caller + "() should be int!");
+    }
+
+    return val.asInt();
+}
+
+Value Builtins::nth(const Value &lst, const Value &idx)
+{
+    const int64_t position = intArgument(idx, "#1", "nth");
+
+    if (position >= 0)
+    {
+        if (lst.getType() == Value::Type::LIST_LITERAL)
         {
-            res[i] = std::dynamic_pointer_cast<IntValue>(vals[i])->value;
+            const ListLiteralValue &elements = lst.asList<ListLiteralValue>();
+
+            if (static_cast<size_t>(position) < elements.size())
+            {
+                return elements[position];
+            }
+        }
+        else if (lst.getType() == Value::Type::INFINITE_LIST)
+        {
+            return lst.asList<InfiniteListValue>().nth(position);
+        }
+        else if (lst.getType() == Value::Type::LIST_STREAM)
+        {
+            Value rest = lst.asList<StreamValue>().drop(position);
+
+            if (rest.getType() == Value::Type::LIST_STREAM || !rest.asList<ListLiteralValue>().empty())
+            {
+                return head(rest);
+            }
         }
         else
         {
-            throw std::runtime_error("Typing error: the arguments to list() must be numbers!");
+            throw std::runtime_error("Typing error: the argument to nth() must be a list!");
         }
     }
 
-    if (vals[2]->type != Value::Type::INT_NUMBER)
+    throw std::runtime_error("Index out of range in nth()!");
+}
+
+Value Builtins::take(const Value &lst, const Value &count)
+{
+    const size_t length = std::max<int64_t>(intArgument(count, "#1", "take"), 0);
+
+    switch (lst.getType())
     {
-        throw std::runtime_error("Typing error: #2 for list() should be int!");
+    case Value::Type::LIST_LITERAL:
+        return ListLiteralValue::slice(lst, 0, std::min(length, lst.asList<ListLiteralValue>().size()));
+    case Value::Type::INFINITE_LIST:
+    {
+        const InfiniteListValue &elements = lst.asList<InfiniteListValue>();
+
+        return Value::makeList<ListLiteralValue>(elements.first, elements.difference, length);
+    }
+    case Value::Type::LIST_STREAM:
+        return lst.asList<StreamValue>().take(length);
+    default:
+        throw std::runtime_error("Typing error: the argument to take() must be a list!");
+    }
+}
+
+Value Builtins::drop(const Value &lst, const Value &count)
+{
+    const size_t offset = std::max<int64_t>(intArgument(count, "#1", "drop"), 0);
+
+    switch (lst.getType())
+    {
+    case Value::Type::LIST_LITERAL:
+    {
+        const size_t size = lst.asList<ListLiteralValue>().size();
+
+        return ListLiteralValue::slice(lst, std::min(offset, size), size - std::min(offset, size));
+    }
+    case Value::Type::INFINITE_LIST:
+    {
+        const InfiniteListValue &elements = lst.asList<InfiniteListValue>();
+
+        return Value::makeList<InfiniteListValue>(elements.first + offset * elements.difference,
+                                                  elements.difference);
+    }
+    case Value::Type::LIST_STREAM:
+        return offset ? lst.asList<StreamValue>().drop(offset) : lst;
+    default:
+        throw std::runtime_error("Typing error: the argument to drop() must be a list!");
+    }
+}
+
+Value Builtins::slice(const Value &lst, const Value &offset, const Value &length)
+{
+    intArgument(length, "#2", "slice");
+
+    return take(drop(lst, offset), length);
+}
+
+Value Builtins::last(const Value &lst)
+{
+    if (lst.getType() == Value::Type::LIST_STREAM)
+    {
+        return last(lst.asList<StreamValue>().materialize());
+    }
+    else if (lst.getType() == Value::Type::INFINITE_LIST)
+    {
+        throw std::runtime_error("Cannot get last() of infinite list!");
+    }
+    else if (lst.getType() != Value::Type::LIST_LITERAL)
+    {
+        throw std::runtime_error("Typing error: the argument to last() must be a list!");
+    }
+
+    const ListLiteralValue &elements = lst.asList<ListLiteralValue>();
+    if (elements.empty())
+    {
+        throw std::runtime_error("Cannot get last() of empty list!");
+    }
+
+    return elements[elements.size() - 1];
+}
+
+void SumAccumulator::add(const Value &val)
+{
+    if (val.getType() == Value::Type::INT_NUMBER)
+    {
+        intSum += val.asInt();
     }
-    size = std::dynamic_pointer_cast<IntValue>(vals[2])->value;
+    else if (val.getType() == Value::Type::REAL_NUMBER)
+    {
+        realSum += val.asReal();
+        isReal = true;
+    }
+    else
+    {
+        throw std::runtime_error("Typing error: the elements of sum() must be numbers!");
+    }
+}
+
+//! Returns the list literal if lst is a non-empty range, otherwise nullptr. The reductions
+//! over ranges are computed in closed form.
+static const ListLiteralValue* rangeOf(const Value &lst)
+{
+    if (lst.getType() != Value::Type::LIST_LITERAL)
+    {
+        return nullptr;
+    }
+
+    const ListLiteralValue &list = lst.asList<ListLiteralValue>();
+
+    return list.isRange() && !list.empty() ? &list : nullptr;
+}
+
+//! Index of the first element of an arithmetic progression equal to val or -1. Only the
+//! elements around (val - first) / step are compared, so infinite lists are searched too.
+template <class Element>
+static int64_t progressionIndexOf(double first, double step, double count, const Value &val, Element element)
+{
+    Value target = val;
 
-    std::vector<std::shared_ptr<Value>> values;
-    for (int i = 0; i < size; ++i)
+    // Numbers equal singleton lists
+    while (target.getType() == Value::Type::LIST_STREAM || target.getType() == Value::Type::LIST_LITERAL)
     {
-        double val = res[0] + res[1] * i;
-        if (isDouble)
+        if (target.getType() == Value::Type::LIST_STREAM)
         {
-            values.push_back(std::dynamic_pointer_cast<Value>(
-                std::make_shared<RealValue>(val)
-            ));
+            target = target.asList<StreamValue>().materialize();
+        }
+        else if (target.asList<ListLiteralValue>().size() == 1)
+        {
+            target = target.asList<ListLiteralValue>()[0];
         }
         else
         {
-            values.push_back(std::dynamic_pointer_cast<Value>(
-                std::make_shared<IntValue>(trunc(val))
-            ));
+            return -1;
+        }
+    }
+
+    if (!target.isNumber() || count < 1)
+    {
+        return -1;
+    }
+
+    // The elements equal to target lie in an interval of indexes, its start is the candidate
+    double candidate = 0;
+    if (step != 0)
+    {
+        const double EPS = 1.0/(1<<30);
+        const double lo = (target.asNumber() - first - EPS) / step;
+        const double hi = (target.asNumber() - first + EPS) / step;
+
+        candidate = std::floor(std::min(lo, hi)) + 1;
+    }
+
+    // Indexes past int64_t are out of reach of an int result anyway. Doubles stop counting
+    // beyond 2^53, so the neighbours of the candidate are counted as ints.
+    if (!(candidate - 1 < static_cast<double>(std::numeric_limits<int64_t>::max())))
+    {
+        return -1;
+    }
+
+    int64_t idx = candidate > 1 ? static_cast<int64_t>(candidate - 1) : 0;
+    for (int i = 0; i < 3 && static_cast<double>(idx) < count; ++i, ++idx)
+    {
+        if (Builtins::equal(element(static_cast<size_t>(idx)), target))
+        {
+            return idx;
         }
     }
 
-    return std::dynamic_pointer_cast<Value>(std::make_shared<ListLiteralValue>(values));
+    return -1;
 }
 
-std::shared_ptr<Value> sqrtFunc(FunctionScope &fncScp)
+Value Builtins::indexOf(const Value &lst, const Value &val)
 {
-    const std::shared_ptr<Value>& fst = fncScp.nth(0);
+    if (lst.getType() == Value::Type::INFINITE_LIST)
+    {
+        const InfiniteListValue &list = lst.asList<InfiniteListValue>();
+
+        return Value::makeInt(progressionIndexOf(list.first, list.difference, HUGE_VAL, val,
+                                                 [&list](size_t idx) { return list.nth(idx); }));
+    }
 
-    if (fst->type == Value::Type::INT_NUMBER)
+    Value elements = finiteList(lst, "indexOf");
+    if (const ListLiteralValue *range = rangeOf(elements))
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(
-            std::sqrt((double)std::dynamic_pointer_cast<IntValue>(fst)->value)
-        ));
+        return Value::makeInt(progressionIndexOf(range->rangeFirst(), range->rangeStep(), range->size(), val,
+                                                 [range](size_t idx) { return (*range)[idx]; }));
     }
-    else if (fst->type == Value::Type::REAL_NUMBER)
+
+    int64_t idx = 0;
+    for (const Value &element : elements.asList<ListLiteralValue>())
     {
-        return std::dynamic_pointer_cast<Value>(std::make_shared<RealValue>(
-            std::sqrt(std::dynamic_pointer_cast<RealValue>(fst)->value)
-        ));
+        if (equal(element, val))
+        {
+            return Value::makeInt(idx);
+        }
+        ++idx;
     }
-    
-    throw std::runtime_error("Typing error: the arguments to sqrt() must be a number!");
+
+    return Value::makeInt(-1);
+}
+
+Value Builtins::contains(const Value &lst, const Value &val)
+{
+    return Value::makeInt(indexOf(lst, val).asInt() >= 0);
+}
+
+//! Elements of a finite list unpacked for the Kernels
+struct NumberList
+{
+    enum class Type
+    {
+        INTS,
+        REALS,
+        MIXED,  // Other lists, their elements go through the scalar builtins
+    };
+
+    Value elements;
+    Type type;
+    std::vector<int64_t> ints;
+    std::vector<double> reals;
+
+    NumberList(const Value &lst, const char *caller) : elements(Builtins::finiteList(lst, caller))
+    {
+        const ListLiteralValue &list = elements.asList<ListLiteralValue>();
+
+        if (list.unpack(ints))
+        {
+            type = Type::INTS;
+        }
+        else if (ints.clear(), list.unpack(reals))
+        {
+            type = Type::REALS;
+        }
+        else
+        {
+            reals.clear();
+            type = Type::MIXED;
+        }
+    }
+
+    size_t size() const noexcept { return elements.asList<ListLiteralValue>().size(); }
+
+    //! Converts ints to reals
+    void toReals()
+    {
+        if (type == Type::INTS)
+        {
+            reals.assign(ints.begin(), ints.end());
+            ints.clear();
+            type = Type::REALS;
+        }
+    }
+};
+
+typedef void (*IntKernel)(const int64_t*, const int64_t*, int64_t*, size_t);
+typedef void (*RealKernel)(const double*, const double*, double*, size_t);
+
+//! Applies an arithmetic builtin to the pairs of elements of two lists of the same length.
+//! The pairs get the types scalar() would give them, so ints meet reals only as reals.
+static Value elementwise(const Value &fst, const Value &snd, const char *caller,
+                         Value (*scalar)(const Value&, const Value&),
+                         IntKernel intKernel, RealKernel realKernel, bool isDivision)
+{
+    NumberList fstNumbers(fst, caller);
+    NumberList sndNumbers(snd, caller);
+    const size_t count = fstNumbers.size();
+
+    if (count != sndNumbers.size())
+    {
+        throw std::runtime_error(std::string("Lists of different lengths given to ") + caller + "()!");
+    }
+
+    if (fstNumbers.type == NumberList::Type::MIXED || sndNumbers.type == NumberList::Type::MIXED)
+    {
+        const ListLiteralValue &fstList = fstNumbers.elements.asList<ListLiteralValue>();
+        const ListLiteralValue &sndList = sndNumbers.elements.asList<ListLiteralValue>();
+
+        std::vector<Value> values;
+        values.reserve(count);
+        ListLiteralValue::Iterator sndIt = sndList.begin();
+        for (const Value &val : fstList)
+        {
+            values.push_back(scalar(val, *sndIt));
+            ++sndIt;
+        }
+
+        return Value::makeList<ListLiteralValue>(std::move(values));
+    }
+
+    if (fstNumbers.type == NumberList::Type::INTS && sndNumbers.type == NumberList::Type::INTS)
+    {
+        if (isDivision && Kernels::findZero(sndNumbers.ints.data(), count) != count)
+        {
+            throw std::runtime_error("Division by zero!");
+        }
+
+        intKernel(fstNumbers.ints.data(), sndNumbers.ints.data(), fstNumbers.ints.data(), count);
+
+        return Value::makeList<ListLiteralValue>(std::move(fstNumbers.ints));
+    }
+
+    fstNumbers.toReals();
+    sndNumbers.toReals();
+    if (isDivision && Kernels::findZero(sndNumbers.reals.data(), count) != count)
+    {
+        throw std::runtime_error("Division by zero!");
+    }
+
+    realKernel(fstNumbers.reals.data(), sndNumbers.reals.data(), fstNumbers.reals.data(), count);
+
+    return Value::makeList<ListLiteralValue>(std::move(fstNumbers.reals));
+}
+
+Value Builtins::vadd(const Value &fst, const Value &snd)
+{
+    return elementwise(fst, snd, "vadd", add, Kernels::add, Kernels::add, false);
+}
+
+Value Builtins::vsub(const Value &fst, const Value &snd)
+{
+    return elementwise(fst, snd, "vsub", sub, Kernels::sub, Kernels::sub, false);
+}
+
+Value Builtins::vmul(const Value &fst, const Value &snd)
+{
+    return elementwise(fst, snd, "vmul", mul, Kernels::mul, Kernels::mul, false);
+}
+
+Value Builtins::vdiv(const Value &fst, const Value &snd)
+{
+    return elementwise(fst, snd, "vdiv", div, Kernels::div, Kernels::div, true);
+}
+
+Value Builtins::vsqrt(const Value &lst)
+{
+    NumberList numbers(lst, "vsqrt");
+
+    if (numbers.type == NumberList::Type::MIXED)
+    {
+        std::vector<Value> values;
+        values.reserve(numbers.size());
+        for (const Value &val : numbers.elements.asList<ListLiteralValue>())
+        {
+            values.push_back(sqrt(val));
+        }
+
+        return Value::makeList<ListLiteralValue>(std::move(values));
+    }
+
+    numbers.toReals();
+    Kernels::sqrt(numbers.reals.data(), numbers.reals.data(), numbers.reals.size());
+
+    return Value::makeList<ListLiteralValue>(std::move(numbers.reals));
+}
+
+Value Builtins::sum(const Value &lst)
+{
+    if (const ListLiteralValue *range = rangeOf(lst))
+    {
+        const uint64_t count = range->size();
+
+        if ((*range)[0].getType() == Value::Type::INT_NUMBER)
+        {
+            // count * first + step * count * (count - 1) / 2, wrapping around like the kernel
+            const uint64_t first = range->intRangeFirst();
+            const uint64_t step = range->intRangeStep();
+            const uint64_t pairs = count % 2 ? count * ((count - 1) / 2) : (count / 2) * (count - 1);
+
+            return Value::makeInt(static_cast<int64_t>(count * first + step * pairs));
+        }
+
+        return Value::makeReal(count * range->rangeFirst() + range->rangeStep() * (count * (count - 1.0) / 2));
+    }
+
+    NumberList numbers(lst, "sum");
+
+    switch (numbers.type)
+    {
+    case NumberList::Type::INTS:
+        return Value::makeInt(Kernels::sum(numbers.ints.data(), numbers.ints.size()));
+    case NumberList::Type::REALS:
+        return Value::makeReal(Kernels::sum(numbers.reals.data(), numbers.reals.size()));
+    default:
+        break;
+    }
+
+    SumAccumulator res;
+    for (const Value &val : numbers.elements.asList<ListLiteralValue>())
+    {
+        res.add(val);
+    }
+
+    return res.result();
+}
+
+Value Builtins::product(const Value &lst)
+{
+    NumberList numbers(lst, "product");
+
+    switch (numbers.type)
+    {
+    case NumberList::Type::INTS:
+        return Value::makeInt(Kernels::product(numbers.ints.data(), numbers.ints.size()));
+    case NumberList::Type::REALS:
+        return Value::makeReal(Kernels::product(numbers.reals.data(), numbers.reals.size()));
+    default:
+        break;
+    }
+
+    Value res = Value::makeInt(1);
+    for (const Value &val : numbers.elements.asList<ListLiteralValue>())
+    {
+        res = mul(res, val);
+    }
+
+    return res;
+}
+
+Value Builtins::dot(const Value &fst, const Value &snd)
+{
+    NumberList fstNumbers(fst, "dot");
+    NumberList sndNumbers(snd, "dot");
+    const size_t count = fstNumbers.size();
+
+    if (count != sndNumbers.size())
+    {
+        throw std::runtime_error("Lists of different lengths given to dot()!");
+    }
+
+    if (fstNumbers.type == NumberList::Type::MIXED || sndNumbers.type == NumberList::Type::MIXED)
+    {
+        Value res = Value::makeInt(0);
+        ListLiteralValue::Iterator sndIt = sndNumbers.elements.asList<ListLiteralValue>().begin();
+        for (const Value &val : fstNumbers.elements.asList<ListLiteralValue>())
+        {
+            res = add(res, mul(val, *sndIt));
+            ++sndIt;
+        }
+
+        return res;
+    }
+    else if (fstNumbers.type == NumberList::Type::INTS && sndNumbers.type == NumberList::Type::INTS)
+    {
+        return Value::makeInt(Kernels::dot(fstNumbers.ints.data(), sndNumbers.ints.data(), count));
+    }
+
+    fstNumbers.toReals();
+    sndNumbers.toReals();
+
+    return Value::makeReal(Kernels::dot(fstNumbers.reals.data(), sndNumbers.reals.data(), count));
+}
+
+//! min() or max() of a list, isMin selects which
+static Value extreme(const Value &lst, bool isMin)
+{
+    const char *caller = isMin ? "min" : "max";
+
+    if (const ListLiteralValue *range = rangeOf(lst))
+    {
+        const bool ascending = range->rangeStep() >= 0;
+
+        return (*range)[isMin == ascending ? 0 : range->size() - 1];
+    }
+
+    NumberList numbers(lst, caller);
+
+    if (numbers.size() == 0)
+    {
+        throw std::runtime_error(std::string("Cannot get ") + caller + "() of empty list!");
+    }
+
+    switch (numbers.type)
+    {
+    case NumberList::Type::INTS:
+        return Value::makeInt(isMin ? Kernels::min(numbers.ints.data(), numbers.ints.size())
+                                    : Kernels::max(numbers.ints.data(), numbers.ints.size()));
+    case NumberList::Type::REALS:
+        return Value::makeReal(isMin ? Kernels::min(numbers.reals.data(), numbers.reals.size())
+                                     : Kernels::max(numbers.reals.data(), numbers.reals.size()));
+    default:
+        break;
+    }
+
+    // le() throws for the values it can't compare
+    const ListLiteralValue &list = numbers.elements.asList<ListLiteralValue>();
+    Value res = list[0];
+    for (const Value &val : list)
+    {
+        if (Builtins::condition(isMin ? Builtins::le(val, res) : Builtins::le(res, val)))
+        {
+            res = val;
+        }
+    }
+
+    return res;
+}
+
+Value Builtins::min(const Value &lst)
+{
+    return extreme(lst, true);
+}
+
+Value Builtins::max(const Value &lst)
+{
+    return extreme(lst, false);
+}
+
+// Ranges shorter than this are sorted by insertion
+static const size_t insertionSortLimit = 16;
+// Ranges shorter than this are not split across threads
+static const size_t parallelSortLimit = 1 << 16;
+
+//! Stable merge sort of [first, last), buffer holds as many elements. Only compares elements
+//! inside the range, so it stays safe for comparators which are not a strict weak ordering.
+//! Large halves are sorted by separate threads while threads is above 1.
+template <class T, class Less>
+static void mergeSort(T *first, T *last, T *buffer, const Less &less, unsigned threads)
+{
+    size_t count = last - first;
+
+    if (count <= insertionSortLimit)
+    {
+        for (T *it = first + 1; it < last; ++it)
+        {
+            T val = std::move(*it);
+            T *pos = it;
+            for (; pos > first && less(val, *(pos - 1)); --pos)
+            {
+                *pos = std::move(*(pos - 1));
+            }
+            *pos = std::move(val);
+        }
+
+        return;
+    }
+
+    T *middle = first + count / 2;
+    T *bufferMiddle = buffer + count / 2;
+    if (threads > 1 && count >= parallelSortLimit)
+    {
+        std::thread worker(mergeSort<T, Less>, first, middle, buffer, std::cref(less), threads / 2);
+        mergeSort(middle, last, bufferMiddle, less, threads - threads / 2);
+        worker.join();
+    }
+    else
+    {
+        mergeSort(first, middle, buffer, less, 1);
+        mergeSort(middle, last, bufferMiddle, less, 1);
+    }
+
+    // Already sorted input needs no merging
+    if (!less(*middle, *(middle - 1)))
+    {
+        return;
+    }
+
+    std::merge(std::make_move_iterator(first), std::make_move_iterator(middle),
+               std::make_move_iterator(middle), std::make_move_iterator(last), buffer, less);
+    std::move(buffer, buffer + count, first);
+}
+
+//! Sorts values with mergeSort using every core
+template <class T, class Less>
+static void parallelSort(std::vector<T> &values, const Less &less)
+{
+    std::vector<T> buffer(values.size());
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    mergeSort(values.data(), values.data() + values.size(), buffer.data(), less, threads);
+}
+
+Value Builtins::sort(const Value &lst)
+{
+    Value elements = finiteList(lst, "sort");
+    const ListLiteralValue &list = elements.asList<ListLiteralValue>();
+
+    if (list.empty())
+    {
+        return elements;
+    }
+
+    std::vector<int64_t> ints;
+    if (list.unpack(ints))
+    {
+        parallelSort(ints, std::less<int64_t>());
+
+        return Value::makeList<ListLiteralValue>(std::move(ints));
+    }
+
+    std::vector<double> reals;
+    if (list.unpack(reals))
+    {
+        parallelSort(reals, std::less<double>());
+
+        return Value::makeList<ListLiteralValue>(std::move(reals));
+    }
+
+    // Lists, other values and ints mixed with reals can't be compared by le()
+    throw std::runtime_error("Typing error: the argument to sort() must be a list of numbers - all int or all real!");
+}
+
+Value Builtins::sortBy(GlobalScope &globalScope, const Value &lst, const Value &function)
+{
+    FunctionCaller f(globalScope, function, 2, "sortBy");
+    Value elements = finiteList(lst, "sortBy");
+    const ListLiteralValue &list = elements.asList<ListLiteralValue>();
+
+    std::vector<Value> values(list.begin(), list.end());
+    std::vector<Value> buffer(values.size());
+    // The interpreter isn't thread safe, so user comparisons run on this thread only
+    mergeSort(values.data(), values.data() + values.size(), buffer.data(),
+              [&f](const Value &fst, const Value &snd) { return condition(f(fst, snd)); }, 1);
+
+    return Value::makeList<ListLiteralValue>(std::move(values));
+}
+
+Value Builtins::map(GlobalScope &globalScope, const Value &function, const Value &lst)
+{
+    FunctionCaller f(globalScope, function, 1, "map");
+    Value elements = Builtins::finiteList(lst, "map");
+
+    std::vector<Value> values;
+    values.reserve(elements.asList<ListLiteralValue>().size());
+    for (const Value &val : elements.asList<ListLiteralValue>())
+    {
+        values.push_back(f(val));
+    }
+
+    return Value::makeList<ListLiteralValue>(std::move(values));
+}
+
+Value Builtins::filter(GlobalScope &globalScope, const Value &function, const Value &lst)
+{
+    FunctionCaller f(globalScope, function, 1, "filter");
+    Value elements = Builtins::finiteList(lst, "filter");
+
+    std::vector<Value> values;
+    for (const Value &val : elements.asList<ListLiteralValue>())
+    {
+        if (condition(f(val)))
+        {
+            values.push_back(val);
+        }
+    }
+
+    return Value::makeList<ListLiteralValue>(std::move(values));
+}
+
+Value Builtins::foldl(GlobalScope &globalScope, const Value &function, const Value &init, const Value &lst)
+{
+    FunctionCaller f(globalScope, function, 2, "foldl");
+    Value elements = Builtins::finiteList(lst, "foldl");
+
+    Value acc = init;
+    for (const Value &val : elements.asList<ListLiteralValue>())
+    {
+        acc = f(acc, val);
+    }
+
+    return acc;
+}
+
+Value Builtins::foldr(GlobalScope &globalScope, const Value &function, const Value &init, const Value &lst)
+{
+    FunctionCaller f(globalScope, function, 2, "foldr");
+    Value elements = Builtins::finiteList(lst, "foldr");
+
+    std::vector<Value> values(elements.asList<ListLiteralValue>().begin(), elements.asList<ListLiteralValue>().end());
+    Value acc = init;
+    for (size_t i = values.size(); i > 0; --i)
+    {
+        acc = f(values[i - 1], acc);
+    }
+
+    return acc;
+}
+
+Value Builtins::zipWith(GlobalScope &globalScope, const Value &function, const Value &fst, const Value &snd)
+{
+    FunctionCaller f(globalScope, function, 2, "zipWith");
+    Value fstElements = Builtins::finiteList(fst, "zipWith");
+    Value sndElements = Builtins::finiteList(snd, "zipWith");
+    const ListLiteralValue &fstList = fstElements.asList<ListLiteralValue>();
+    const ListLiteralValue &sndList = sndElements.asList<ListLiteralValue>();
+
+    std::vector<Value> values;
+    values.reserve(std::min(fstList.size(), sndList.size()));
+    ListLiteralValue::Iterator sndIt = sndList.begin();
+    for (const Value &val : fstList)
+    {
+        if (values.size() == sndList.size())
+        {
+            break;
+        }
+
+        values.push_back(f(val, *sndIt));
+        ++sndIt;
+    }
+
+    return Value::makeList<ListLiteralValue>(std::move(values));
+}
+
+Value sumFunc(FunctionScope &fncScp)
+{
+    return Builtins::sum(fncScp.nth(0));
+}
+
+Value indexOfFunc(FunctionScope &fncScp)
+{
+    return Builtins::indexOf(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value containsFunc(FunctionScope &fncScp)
+{
+    return Builtins::contains(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value productFunc(FunctionScope &fncScp)
+{
+    return Builtins::product(fncScp.nth(0));
+}
+
+Value dotFunc(FunctionScope &fncScp)
+{
+    return Builtins::dot(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value minFunc(FunctionScope &fncScp)
+{
+    return Builtins::min(fncScp.nth(0));
+}
+
+Value maxFunc(FunctionScope &fncScp)
+{
+    return Builtins::max(fncScp.nth(0));
+}
+
+Value vaddFunc(FunctionScope &fncScp)
+{
+    return Builtins::vadd(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value vsubFunc(FunctionScope &fncScp)
+{
+    return Builtins::vsub(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value vmulFunc(FunctionScope &fncScp)
+{
+    return Builtins::vmul(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value vdivFunc(FunctionScope &fncScp)
+{
+    return Builtins::vdiv(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value vsqrtFunc(FunctionScope &fncScp)
+{
+    return Builtins::vsqrt(fncScp.nth(0));
+}
+
+Value nthFunc(FunctionScope &fncScp)
+{
+    return Builtins::nth(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value takeFunc(FunctionScope &fncScp)
+{
+    return Builtins::take(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value dropFunc(FunctionScope &fncScp)
+{
+    return Builtins::drop(fncScp.nth(0), fncScp.nth(1));
+}
+
+Value sliceFunc(FunctionScope &fncScp)
+{
+    return Builtins::slice(fncScp.nth(0), fncScp.nth(1), fncScp.nth(2));
+}
+
+Value lastFunc(FunctionScope &fncScp)
+{
+    return Builtins::last(fncScp.nth(0));
+}
+
+Value sortFunc(FunctionScope &fncScp)
+{
+    return Builtins::sort(fncScp.nth(0));
+}
+
+Value sortByFunc(FunctionScope &fncScp)
+{
+    return Builtins::sortBy(fncScp.getGlobalScope(), fncScp.nth(0), fncScp.nth(1));
+}
+
+Value mapFunc(FunctionScope &fncScp)
+{
+    return Builtins::map(fncScp.getGlobalScope(), fncScp.nth(0), fncScp.nth(1));
+}
+
+Value filterFunc(FunctionScope &fncScp)
+{
+    return Builtins::filter(fncScp.getGlobalScope(), fncScp.nth(0), fncScp.nth(1));
+}
+
+Value foldlFunc(FunctionScope &fncScp)
+{
+    return Builtins::foldl(fncScp.getGlobalScope(), fncScp.nth(0), fncScp.nth(1), fncScp.nth(2));
+}
+
+Value foldrFunc(FunctionScope &fncScp)
+{
+    return Builtins::foldr(fncScp.getGlobalScope(), fncScp.nth(0), fncScp.nth(1), fncScp.nth(2));
+}
+
+Value zipWithFunc(FunctionScope &fncScp)
+{
+    return Builtins::zipWith(fncScp.getGlobalScope(), fncScp.nth(0), fncScp.nth(1), fncScp.nth(2));
 }
 
 void GlobalScope::loadDefaultLibrary()
 {
-    const std::function<std::shared_ptr<Value>(FunctionScope&)> functions[] = {
+    const std::function<Value(FunctionScope&)> functions[] = {
         eqFunc, leFunc, nandFunc, lengthFunc, headFunc, tailFunc, concatFunc,
         ifFunc, readFunc, writeFunc, intFunc, addFunc, subFunc, mulFunc, divFunc,
-        modFunc, sqrtFunc, list1Func, list2Func, list3Func
+        modFunc, sqrtFunc, list1Func, list2Func, list3Func,
+        mapFunc, filterFunc, foldlFunc, foldrFunc, zipWithFunc, sumFunc,
+        sortFunc, sortByFunc, nthFunc, takeFunc, dropFunc, sliceFunc, lastFunc,
+        productFunc, dotFunc, minFunc, maxFunc, vaddFunc, vsubFunc, vmulFunc, vdivFunc, vsqrtFunc,
+        indexOfFunc, containsFunc
     };
     const std::string names[] = {
         "eq", "le", "nand", "length", "head", "tail", "concat",
         "if", "read", "write", "int", "add", "sub", "mul", "div",
-        "mod", "sqrt", "list", "list", "list"
+        "mod", "sqrt", "list", "list", "list",
+        "map", "filter", "foldl", "foldr", "zipWith", "sum",
+        "sort", "sortBy", "nth", "take", "drop", "slice", "last",
+        "product", "dot", "min", "max", "vadd", "vsub", "vmul", "vdiv", "vsqrt",
+        "indexOf", "contains"
     };
     const size_t arguments[] = {
         2, 2, 2, 1, 1, 1, 2, 
         3, 0, 1, 1, 2, 2, 2, 2,
-        2, 1, 1, 2, 3
+        2, 1, 1, 2, 3,
+        2, 2, 3, 3, 3, 1,
+        1, 2, 2, 2, 2, 3, 1,
+        1, 2, 1, 1, 2, 2, 2, 2, 1,
+        2, 2
     };
-    for (size_t i = 0; i < 20; ++i)
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
     {
         Token tok = {Token::Type::FUNC, names[i], -1};
         std::shared_ptr<FunctionDefinition> fDef = std::make_shared<FunctionDefinition>(
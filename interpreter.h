@@ -1,6 +1,8 @@
 #pragma once
 
+#include "effects.h"
 #include "return_value.h"
+#include "symbols.h"
 
 #include <string>
 #include <unordered_map>
@@ -12,15 +14,42 @@
 struct Node;
 struct FunctionDefinition;
 struct FunctionScope;
+class MemoTable;
+class TypeInference;
 
 //! Stores function definitions
 struct GlobalScope
 {
+    //! Available execution engines
+    enum class Engine
+    {
+        TREE_WALKER, // Evaluates the AST directly through Node::eval
+        BYTECODE,    // Compiles the AST and runs it on the VirtualMachine
+    };
+
+    //! Default limit of nested calls on the VirtualMachine
+    static const size_t defaultMaxDepth = 1000000;
+
+    GlobalScope() noexcept
+        : epoch(nextEpoch()), libraryVersion(0), engine(Engine::TREE_WALKER), maxDepth(defaultMaxDepth),
+          memoization(true), typesEpoch(0) {}
+
     //! Checks if function is already defined
-    bool isFunctionDefined(const std::string& name, size_t argc);
+    bool isFunctionDefined(const std::string& name, size_t argc) const;
+
+    //! Returns the definition of an interned name with argc arguments or nullptr if there is none
+    const FunctionDefinition* findFunction(size_t symbol, size_t argc) const noexcept
+    {
+        if (symbol >= definitions.size() || argc >= definitions[symbol].size())
+        {
+            return nullptr;
+        }
+
+        return definitions[symbol][argc].get();
+    }
 
     //! Calls function
-    std::shared_ptr<Value> callFunction(const std::string& name, FunctionScope& fncScp);
+    Value callFunction(size_t symbol, FunctionScope& fncScp) const;
 
     //! True if it's a redefinition, false otherwise
     bool addFunction(std::shared_ptr<FunctionDefinition> definition);
@@ -28,41 +57,178 @@ struct GlobalScope
     //! Loads the pre-defined functions
     void loadDefaultLibrary();
 
+    //! Changes every time a function is (re)defined. Unique among all GlobalScope objects,
+    //! so call sites can cache findFunction() results as long as the epoch stays the same.
+    size_t getEpoch() const noexcept { return epoch; }
+
+    //! Changes only when a pre-defined function is redefined. Code which hardcodes the
+    //! behaviour of the default library is valid as long as this stays the same.
+    size_t getLibraryVersion() const noexcept { return libraryVersion; }
+
+    //! Selects the engine used by evaluate()
+    void setEngine(Engine newEngine) noexcept { engine = newEngine; }
+    Engine getEngine() const noexcept { return engine; }
+
+    //! Limits the number of nested calls on the VirtualMachine. Its frames live on the heap,
+    //! so the limit is bounded only by memory.
+    void setMaxDepth(size_t depth) noexcept { maxDepth = depth; }
+    size_t getMaxDepth() const noexcept { return maxDepth; }
+
+    //! Effects of the defined functions, updated as they are (re)defined
+    EffectAnalysis& effects() const noexcept { return effectAnalysis; }
+
+    //! Return types of the defined functions, inferred again after every (re)definition
+    TypeInference& types() const;
+
+    //! Enables memoization of pure recursive functions, see Memo
+    void setMemoization(bool enabled) noexcept { memoization = enabled; }
+    bool getMemoization() const noexcept { return memoization; }
+
+    //! Memo table of function or nullptr if its calls are not memoized. Calls of a memoized
+    //! function may evaluate all arguments and return a stored result for the same values.
+    std::shared_ptr<MemoTable> memoOf(const FunctionDefinition& function) const;
+
+    //! Evaluates a parsed expression with the selected engine
+    Value evaluate(const std::shared_ptr<Node>& ast, FunctionScope& fncScp);
+
+    //! Calls function with the selected engine, fncScp holds its arguments
+    Value call(const FunctionDefinition& function, FunctionScope& fncScp);
+
 private:
-    std::unordered_map<std::string, std::unordered_map<size_t, std::shared_ptr<FunctionDefinition>>> definitions;
+    // Indexed by interned name and then by argument count
+    std::vector<std::vector<std::shared_ptr<FunctionDefinition>>> definitions;
+    size_t epoch;
+    size_t libraryVersion;
+    Engine engine;
+    size_t maxDepth;
+    bool memoization;
+    mutable EffectAnalysis effectAnalysis;
+    mutable std::shared_ptr<TypeInference> typeInference;
+    mutable size_t typesEpoch;
+
+    static size_t nextEpoch() noexcept;
 
 };
 
-//! Stores needed information for function execution
-struct FunctionScope
+//! Call-by-need suspension of a function argument. Evaluated at most once.
+struct Thunk
 {
-    FunctionScope(GlobalScope &globalExecContext,
-                  std::shared_ptr<FunctionScope> parentScope,
-                  const std::vector<std::shared_ptr<Node>> &parameters) noexcept
-        : globalExecContext(globalExecContext),
-          parentScope(parentScope),
-          parameters(parameters)
+    Thunk(std::shared_ptr<Node> expression, std::shared_ptr<FunctionScope> scope) noexcept
+        : expression(expression), scope(scope)
+    {
+    }
+    //! Argument whose value is already known
+    explicit Thunk(const Value &value) noexcept : value(value) {}
+
+    //! Evaluates the argument on first use and returns the cached value afterwards
+    const Value& force()
+    {
+        if (!value)
+        {
+            evaluate();
+        }
+
+        return value;
+    }
+
+    //! The argument expression, null once the thunk is forced
+    const std::shared_ptr<Node>& getExpression() const noexcept { return expression; }
+
+    //! The scope the expression is evaluated in, null once the thunk is forced
+    const std::shared_ptr<FunctionScope>& getScope() const noexcept { return scope; }
+
+    //! Replaces the argument with an already known value
+    void assign(const Value &newValue) noexcept
     {
+        expression.reset();
+        scope.reset();
+        value = newValue;
     }
+
+    //! Limit of arguments which are evaluated while evaluating another argument
+    static const size_t maxNesting = 20000;
+
+private:
+    std::shared_ptr<Node> expression;
+    std::shared_ptr<FunctionScope> scope;
+    Value value;
+
+    //! Evaluates the expression and releases the scope it needed
+    void evaluate();
+
+};
+
+//! Stores needed information for function execution. Always owned by a std::shared_ptr,
+//! because the thunks of its child scopes keep it alive instead of copying it.
+struct FunctionScope : public std::enable_shared_from_this<FunctionScope>
+{
     FunctionScope(GlobalScope &globalExecContext,
-                  std::shared_ptr<FunctionScope> parentScope,
-                  std::vector<std::shared_ptr<Node>>&& parameters) noexcept
-        : globalExecContext(globalExecContext),
-          parentScope(parentScope),
-          parameters(std::move(parameters))
+                  const std::shared_ptr<FunctionScope> &parentScope,
+                  const std::vector<std::shared_ptr<Node>> &parameters)
+        : globalExecContext(globalExecContext)
     {
+        thunks.reserve(parameters.size());
+        for (const std::shared_ptr<Node> &param : parameters)
+        {
+            thunks.push_back(std::make_shared<Thunk>(param, parentScope));
+        }
     }
+    FunctionScope(GlobalScope &globalExecContext, std::vector<std::shared_ptr<Thunk>> &&thunks) noexcept
+        : globalExecContext(globalExecContext), thunks(std::move(thunks))
+    {
+    }
+    FunctionScope(const FunctionScope& other) = delete;
+    FunctionScope& operator=(const FunctionScope& other) = delete;
+    ~FunctionScope();
 
-    //! Evals the nth parameter at runtime
-    std::shared_ptr<Value> nth(size_t idx) const;
+    //! Evals the nth parameter at runtime. Each parameter is evaluated at most once.
+    const Value& nth(size_t idx) const
+    {
+        if (idx >= thunks.size())
+        {
+            throwOutOfRange();
+        }
+
+        return thunks[idx]->force();
+    }
 
     //! For lazy evaluation purposes returns head of list
-    std::shared_ptr<Value> headOfList() const;
+    Value headOfList() const;
     //! For lazy evaluation purposes returns tail of list
-    std::shared_ptr<Value> tailOfList() const;
+    Value tailOfList() const;
 
     //! Gets the parameters count
-    size_t paramCount() const noexcept { return parameters.size(); }
+    size_t paramCount() const noexcept { return thunks.size(); }
+
+    //! Replaces the arguments with values if no other scope shares their thunks.
+    //! Returns false if the scope can't be reused.
+    bool reuse(const Value *values, size_t count) noexcept
+    {
+        if (count != thunks.size())
+        {
+            return false;
+        }
+        for (const std::shared_ptr<Thunk> &thunk : thunks)
+        {
+            if (thunk.use_count() != 1)
+            {
+                return false;
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            thunks[i]->assign(values[i]);
+        }
+
+        return true;
+    }
+
+    //! Thunk of the nth parameter or nullptr if there is no such parameter
+    std::shared_ptr<Thunk> getThunk(size_t idx) const noexcept
+    {
+        return idx < thunks.size() ? thunks[idx] : nullptr;
+    }
 
     //! Accessor for the global execution context
     GlobalScope& getGlobalScope() noexcept { return globalExecContext; }
@@ -73,8 +239,123 @@ struct FunctionScope
 private:
     GlobalScope& globalExecContext;
 
-    // We store the parentScope so we can eval the parameters lazy
-    std::shared_ptr<FunctionScope> parentScope;
-    const std::vector<std::shared_ptr<Node>> parameters;
+    // Every thunk points to the scope of the caller, so the caller is never copied
+    std::vector<std::shared_ptr<Thunk>> thunks;
+
+    [[noreturn]] static void throwOutOfRange();
+
+};
+
+//! Value level implementation of the default library. Used by the pre-defined functions
+//! and by the opcodes of the VirtualMachine, so both engines share the same semantics.
+struct Builtins
+{
+    static bool equal(const Value &fst, const Value &snd);
+    static Value le(const Value &fst, const Value &snd);
+    //! Truth value of a nand() operand
+    static bool nandOperand(const Value &val);
+    static Value length(const Value &fst);
+    static Value head(const Value &fst);
+    static Value tail(const Value &fst);
+    static Value concat(const Value &fst, const Value &snd);
+    //! concat() which computes snd only when the elements after fst are used
+    static Value lazyConcat(const Value &fst, const std::shared_ptr<Thunk> &snd);
+    //! True if the second operand of concat() is a call of a pure recursive user function,
+    //! which lazyConcat() may leave unevaluated without dropping effects
+    static bool isLazyRest(const Node *snd, const GlobalScope &globalScope);
+    //! Truth value of an if() condition
+    static bool condition(const Value &fst);
+    static Value read();
+    static Value toInt(const Value &fst);
+    static Value add(const Value &fst, const Value &snd);
+    static Value sub(const Value &fst, const Value &snd);
+    static Value mul(const Value &fst, const Value &snd);
+    static Value div(const Value &fst, const Value &snd);
+    static Value mod(const Value &fst, const Value &snd);
+    // Arithmetic on operands whose types are already known. Ints wrap around on overflow.
+    static int64_t add(int64_t fst, int64_t snd) noexcept { return static_cast<int64_t>(uint64_t(fst) + uint64_t(snd)); }
+    static double add(double fst, double snd) noexcept { return fst + snd; }
+    static int64_t sub(int64_t fst, int64_t snd) noexcept { return static_cast<int64_t>(uint64_t(fst) - uint64_t(snd)); }
+    static double sub(double fst, double snd) noexcept { return fst - snd; }
+    static int64_t mul(int64_t fst, int64_t snd) noexcept { return static_cast<int64_t>(uint64_t(fst) * uint64_t(snd)); }
+    static double mul(double fst, double snd) noexcept { return fst * snd; }
+    static Value sqrt(const Value &fst);
+    static Value list(const Value &first);
+    static Value list(const Value &first, const Value &difference);
+    static Value list(const Value &first, const Value &difference, const Value &count);
+
+    // Random access, the index arguments are ints. Lists are sliced instead of copied.
+    static Value nth(const Value &lst, const Value &idx);
+    static Value take(const Value &lst, const Value &count);
+    static Value drop(const Value &lst, const Value &count);
+    static Value slice(const Value &lst, const Value &offset, const Value &length);
+    static Value last(const Value &lst);
+
+    //! Index of the first element of lst equal to val or -1
+    static Value indexOf(const Value &lst, const Value &val);
+    static Value contains(const Value &lst, const Value &val);
+
+    static Value sum(const Value &lst);
+    static Value product(const Value &lst);
+    static Value dot(const Value &fst, const Value &snd);
+    static Value min(const Value &lst);
+    static Value max(const Value &lst);
+    // Elementwise arithmetic of lists of the same length
+    static Value vadd(const Value &fst, const Value &snd);
+    static Value vsub(const Value &fst, const Value &snd);
+    static Value vmul(const Value &fst, const Value &snd);
+    static Value vdiv(const Value &fst, const Value &snd);
+    static Value vsqrt(const Value &lst);
+    //! Stable sort of numbers in le() order
+    static Value sort(const Value &lst);
+
+    //! Returns the list literal with the elements of a finite list. Throws for other values.
+    static Value finiteList(const Value &lst, const char *caller);
+
+    // Higher-order functions. The function argument is the name of a function, which is
+    // called directly for every element.
+    static Value map(GlobalScope &globalScope, const Value &function, const Value &lst);
+    static Value filter(GlobalScope &globalScope, const Value &function, const Value &lst);
+    static Value foldl(GlobalScope &globalScope, const Value &function, const Value &init, const Value &lst);
+    static Value foldr(GlobalScope &globalScope, const Value &function, const Value &init, const Value &lst);
+    static Value zipWith(GlobalScope &globalScope, const Value &function, const Value &fst, const Value &snd);
+    //! Stable sort where function(x, y) is true if x goes before y
+    static Value sortBy(GlobalScope &globalScope, const Value &lst, const Value &function);
+
+};
+
+//! Sum of numbers as computed by sum(). Stays an int until a real is added.
+struct SumAccumulator
+{
+    SumAccumulator() noexcept : intSum(0), realSum(0), isReal(false) {}
+
+    void add(const Value &val);
+    Value result() const noexcept { return isReal ? Value::makeReal(intSum + realSum) : Value::makeInt(intSum); }
+
+private:
+    int64_t intSum;
+    double realSum;
+    bool isReal;
+
+};
+
+//! Calls a function passed to a higher-order function. The arguments are already evaluated,
+//! so no thunk refers to the scope of the caller.
+class FunctionCaller
+{
+public:
+    //! Resolves the definition of function with argc arguments. caller names the builtin in errors.
+    FunctionCaller(GlobalScope &globalScope, const Value &function, size_t argc, const char *caller);
+
+    Value operator()(const Value &fst);
+    Value operator()(const Value &fst, const Value &snd);
+
+private:
+    GlobalScope &globalScope;
+    const FunctionDefinition *definition;
+    // Scope of the previous call, reused when the callee kept no reference to it
+    std::shared_ptr<FunctionScope> scope;
+
+    Value call(const Value *values, size_t count);
 
 };
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "kernels.h"
+
+#include <cmath>
+
+
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__linux__)
+// Compiles the kernel for AVX2 and for the x86-64 baseline, the loader picks the version
+#define MULTIVERSION __attribute__((target_clones("avx2", "default")))
+#else
+#define MULTIVERSION
+#endif
+
+// Independent accumulators of a reduction, so the additions can run in parallel lanes
+static const size_t lanes = 4;
+
+// Int arithmetic goes through uint64_t, where overflow wraps around instead of being undefined
+static inline int64_t wrap(uint64_t val) { return static_cast<int64_t>(val); }
+
+static inline int64_t addOf(int64_t fst, int64_t snd) { return wrap(uint64_t(fst) + uint64_t(snd)); }
+static inline double addOf(double fst, double snd) { return fst + snd; }
+static inline int64_t mulOf(int64_t fst, int64_t snd) { return wrap(uint64_t(fst) * uint64_t(snd)); }
+static inline double mulOf(double fst, double snd) { return fst * snd; }
+// The minimum divided by -1 overflows, so -1 negates with wraparound
+static inline int64_t divOf(int64_t fst, int64_t snd) { return snd == -1 ? wrap(0 - uint64_t(fst)) : fst / snd; }
+
+template <class T>
+static inline T sumOf(const T *values, size_t count)
+{
+    T acc[lanes] = {};
+    size_t i = 0;
+
+    for (; i + lanes <= count; i += lanes)
+    {
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            acc[lane] = addOf(acc[lane], values[i + lane]);
+        }
+    }
+    for (; i < count; ++i)
+    {
+        acc[0] = addOf(acc[0], values[i]);
+    }
+
+    return addOf(addOf(acc[0], acc[1]), addOf(acc[2], acc[3]));
+}
+
+template <class T>
+static inline T productOf(const T *values, size_t count)
+{
+    T acc[lanes] = {1, 1, 1, 1};
+    size_t i = 0;
+
+    for (; i + lanes <= count; i += lanes)
+    {
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            acc[lane] = mulOf(acc[lane], values[i + lane]);
+        }
+    }
+    for (; i < count; ++i)
+    {
+        acc[0] = mulOf(acc[0], values[i]);
+    }
+
+    return mulOf(mulOf(acc[0], acc[1]), mulOf(acc[2], acc[3]));
+}
+
+template <class T>
+static inline T dotOf(const T *fst, const T *snd, size_t count)
+{
+    T acc[lanes] = {};
+    size_t i = 0;
+
+    for (; i + lanes <= count; i += lanes)
+    {
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            acc[lane] = addOf(acc[lane], mulOf(fst[i + lane], snd[i + lane]));
+        }
+    }
+    for (; i < count; ++i)
+    {
+        acc[0] = addOf(acc[0], mulOf(fst[i], snd[i]));
+    }
+
+    return addOf(addOf(acc[0], acc[1]), addOf(acc[2], acc[3]));
+}
+
+MULTIVERSION void Kernels::add(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = addOf(fst[i], snd[i]);
+    }
+}
+
+MULTIVERSION void Kernels::add(const double *fst, const double *snd, double *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = fst[i] + snd[i];
+    }
+}
+
+MULTIVERSION void Kernels::sub(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = wrap(uint64_t(fst[i]) - uint64_t(snd[i]));
+    }
+}
+
+MULTIVERSION void Kernels::sub(const double *fst, const double *snd, double *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = fst[i] - snd[i];
+    }
+}
+
+MULTIVERSION void Kernels::mul(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = mulOf(fst[i], snd[i]);
+    }
+}
+
+MULTIVERSION void Kernels::mul(const double *fst, const double *snd, double *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = fst[i] * snd[i];
+    }
+}
+
+void Kernels::div(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count)
+{
+    // Neither instruction set divides ints in vectors
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = divOf(fst[i], snd[i]);
+    }
+}
+
+MULTIVERSION void Kernels::div(const double *fst, const double *snd, double *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = fst[i] / snd[i];
+    }
+}
+
+MULTIVERSION void Kernels::sqrt(const double *values, double *res, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        res[i] = std::sqrt(values[i]);
+    }
+}
+
+MULTIVERSION int64_t Kernels::sum(const int64_t *values, size_t count)
+{
+    return sumOf(values, count);
+}
+
+MULTIVERSION double Kernels::sum(const double *values, size_t count)
+{
+    return sumOf(values, count);
+}
+
+MULTIVERSION int64_t Kernels::product(const int64_t *values, size_t count)
+{
+    return productOf(values, count);
+}
+
+MULTIVERSION double Kernels::product(const double *values, size_t count)
+{
+    return productOf(values, count);
+}
+
+MULTIVERSION int64_t Kernels::dot(const int64_t *fst, const int64_t *snd, size_t count)
+{
+    return dotOf(fst, snd, count);
+}
+
+MULTIVERSION double Kernels::dot(const double *fst, const double *snd, size_t count)
+{
+    return dotOf(fst, snd, count);
+}
+
+MULTIVERSION int64_t Kernels::min(const int64_t *values, size_t count)
+{
+    int64_t res = values[0];
+    for (size_t i = 1; i < count; ++i)
+    {
+        res = values[i] < res ? values[i] : res;
+    }
+
+    return res;
+}
+
+double Kernels::min(const double *values, size_t count)
+{
+    // Kept in order, the vector instructions would treat NaN differently
+    double res = values[0];
+    for (size_t i = 1; i < count; ++i)
+    {
+        res = values[i] < res ? values[i] : res;
+    }
+
+    return res;
+}
+
+MULTIVERSION int64_t Kernels::max(const int64_t *values, size_t count)
+{
+    int64_t res = values[0];
+    for (size_t i = 1; i < count; ++i)
+    {
+        res = res < values[i] ? values[i] : res;
+    }
+
+    return res;
+}
+
+double Kernels::max(const double *values, size_t count)
+{
+    double res = values[0];
+    for (size_t i = 1; i < count; ++i)
+    {
+        res = res < values[i] ? values[i] : res;
+    }
+
+    return res;
+}
+
+size_t Kernels::findZero(const int64_t *values, size_t count)
+{
+    size_t i = 0;
+    while (i < count && values[i] != 0)
+    {
+        ++i;
+    }
+
+    return i;
+}
+
+size_t Kernels::findZero(const double *values, size_t count)
+{
+    size_t i = 0;
+    while (i < count && values[i] != 0.0)
+    {
+        ++i;
+    }
+
+    return i;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+//! Bulk arithmetic over packed numbers, used by the vector builtins. On x86-64 every kernel
+//! is compiled for AVX2 and for the baseline SSE2, the version is chosen at runtime.
+//! Int arithmetic wraps around like the elements of sum().
+struct Kernels
+{
+    // res[i] = fst[i] op snd[i], res may alias the operands
+    static void add(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count);
+    static void add(const double *fst, const double *snd, double *res, size_t count);
+    static void sub(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count);
+    static void sub(const double *fst, const double *snd, double *res, size_t count);
+    static void mul(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count);
+    static void mul(const double *fst, const double *snd, double *res, size_t count);
+    //! Divisors must not be zero
+    static void div(const int64_t *fst, const int64_t *snd, int64_t *res, size_t count);
+    static void div(const double *fst, const double *snd, double *res, size_t count);
+    static void sqrt(const double *values, double *res, size_t count);
+
+    //! Reductions. The reals are summed in several lanes, so the result may differ from
+    //! summing them in order in the last bits.
+    static int64_t sum(const int64_t *values, size_t count);
+    static double sum(const double *values, size_t count);
+    static int64_t product(const int64_t *values, size_t count);
+    static double product(const double *values, size_t count);
+    static int64_t dot(const int64_t *fst, const int64_t *snd, size_t count);
+    static double dot(const double *fst, const double *snd, size_t count);
+    //! Minimum or maximum in le() order, count must not be 0
+    static int64_t min(const int64_t *values, size_t count);
+    static double min(const double *values, size_t count);
+    static int64_t max(const int64_t *values, size_t count);
+    static double max(const double *values, size_t count);
+
+    //! Index of the first zero or count
+    static size_t findZero(const int64_t *values, size_t count);
+    static size_t findZero(const double *values, size_t count);
+
+};
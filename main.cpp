@@ -19,6 +19,42 @@
 
 int main(int argc, const char** argv)
 {
+    const std::string maxDepthOption = "--max-depth=";
+
+    while (argc > 1 && std::string(argv[1]).compare(0, 2, "--") == 0)
+    {
+        std::string option(argv[1]);
+
+        if (option == "--vm") // Use the bytecode engine
+        {
+            ListFunc::getInstance().setEngine(GlobalScope::Engine::BYTECODE);
+        }
+        else if (option == "--no-memo") // Call every function again instead of reusing results
+        {
+            ListFunc::getInstance().setMemoization(false);
+        }
+        else if (option.compare(0, maxDepthOption.size(), maxDepthOption) == 0) // Limit of nested calls
+        {
+            try
+            {
+                ListFunc::getInstance().setMaxDepth(std::stoull(option.substr(maxDepthOption.size())));
+            }
+            catch (const std::logic_error&)
+            {
+                std::cout << "Invalid maximum depth!\n";
+                return -1;
+            }
+        }
+        else
+        {
+            std::cout << "Unknown option " << option << "!\n";
+            return -1;
+        }
+
+        --argc;
+        ++argv;
+    }
+
     if (argc == 1) // Run the program
     {
         return ListFunc::getInstance().run();
@@ -0,0 +1,299 @@
+#include "memo.h"
+#include "optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace
+{
+
+// Pre-defined functions which evaluate all their arguments
+const char* const strictBuiltins[] = {
+    "eq", "le", "length", "head", "tail", "int", "add", "sub", "mul", "div", "mod", "sqrt",
+    "list", "sum", "sort", "nth", "take", "drop", "slice", "last", "product", "dot", "min",
+    "max", "vadd", "vsub", "vmul", "vdiv", "vsqrt", "indexOf", "contains",
+};
+
+bool isStrictBuiltin(const std::string& name)
+{
+    for (const char* candidate : strictBuiltins)
+    {
+        if (name == candidate)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//! Marks the parameters which are evaluated whenever node is. Calls of the function self
+//! force the arguments of the parameters in assumed.
+void markForced(const Node* node, const GlobalScope& globalScope, const EffectAnalysis::Function& self,
+                const std::vector<bool>& assumed, std::vector<bool>& forced)
+{
+    static const size_t ifSymbol = SymbolTable::intern("if");
+    static const size_t nandSymbol = SymbolTable::intern("nand");
+
+    if (const ArgumentNode* arg = dynamic_cast<const ArgumentNode*>(node))
+    {
+        if (arg->index < forced.size())
+        {
+            forced[arg->index] = true;
+        }
+    }
+    else if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        const FunctionDefinition* function = globalScope.findFunction(call->symbol, call->arguments.size());
+        if (call->symbol == self.first && call->arguments.size() == self.second)
+        {
+            for (size_t i = 0; i < assumed.size(); ++i)
+            {
+                if (assumed[i])
+                {
+                    markForced(call->arguments[i].get(), globalScope, self, assumed, forced);
+                }
+            }
+            return;
+        }
+        else if (!function || !function->builtin)
+        {
+            // Calls of other user functions may leave their arguments unevaluated
+            return;
+        }
+
+        if (call->symbol == ifSymbol && call->arguments.size() == 3)
+        {
+            // Forced by the condition or by both branches
+            std::vector<bool> thenForced(forced.size()), elseForced(forced.size());
+            markForced(call->arguments[0].get(), globalScope, self, assumed, forced);
+            markForced(call->arguments[1].get(), globalScope, self, assumed, thenForced);
+            markForced(call->arguments[2].get(), globalScope, self, assumed, elseForced);
+
+            for (size_t i = 0; i < forced.size(); ++i)
+            {
+                forced[i] = forced[i] || (thenForced[i] && elseForced[i]);
+            }
+        }
+        else if (call->symbol == nandSymbol && call->arguments.size() == 2)
+        {
+            markForced(call->arguments[0].get(), globalScope, self, assumed, forced);
+        }
+        else if (isStrictBuiltin(function->builtin->token.data))
+        {
+            for (const std::shared_ptr<Node> &arg : call->arguments)
+            {
+                markForced(arg.get(), globalScope, self, assumed, forced);
+            }
+        }
+    }
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        markForced(inlined->tailNode(globalScope), globalScope, self, assumed, forced);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        markForced(arithmetic->original.get(), globalScope, self, assumed, forced);
+    }
+}
+
+//! Number of calls of the function symbol with argc arguments in the expression
+size_t countCalls(const Node* node, const GlobalScope& globalScope, size_t symbol, size_t argc)
+{
+    size_t count = 0;
+
+    if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        count += call->symbol == symbol && call->arguments.size() == argc;
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            count += countCalls(arg.get(), globalScope, symbol, argc);
+        }
+    }
+    else if (const ListLiteralNode* list = dynamic_cast<const ListLiteralNode*>(node))
+    {
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            count += countCalls(item.get(), globalScope, symbol, argc);
+        }
+    }
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        count = countCalls(inlined->tailNode(globalScope), globalScope, symbol, argc);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        count = countCalls(arithmetic->original.get(), globalScope, symbol, argc);
+    }
+
+    return count;
+}
+
+//! The bits of a number or function name, the address of a list
+uint64_t bitsOf(const Value& val) noexcept
+{
+    switch (val.getType())
+    {
+    case Value::Type::INT_NUMBER:
+        return static_cast<uint64_t>(val.asInt());
+    case Value::Type::REAL_NUMBER:
+    {
+        double real = val.asReal();
+        uint64_t bits;
+        std::memcpy(&bits, &real, sizeof(bits));
+        return bits;
+    }
+    case Value::Type::FUNCTION:
+        return val.asFunction();
+    default:
+        return reinterpret_cast<uintptr_t>(val.listIdentity());
+    }
+}
+
+}
+
+const size_t MemoTable::maxEntries;
+
+MemoTable::Key MemoTable::keyOf(const FunctionScope& fncScp)
+{
+    Key key;
+    key.reserve(fncScp.paramCount());
+
+    for (size_t i = 0; i < fncScp.paramCount(); ++i)
+    {
+        key.push_back(fncScp.nth(i));
+    }
+
+    return key;
+}
+
+Value MemoTable::find(const Key& key)
+{
+    auto found = index.find(key);
+    if (found == index.end())
+    {
+        return Value();
+    }
+
+    entries.splice(entries.begin(), entries, found->second);
+
+    return found->second->second;
+}
+
+void MemoTable::insert(const Key& key, const Value& result)
+{
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        found->second->second = result;
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+
+    if (index.size() >= maxEntries)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+
+    entries.emplace_front(key, result);
+    index.emplace(key, entries.begin());
+}
+
+size_t MemoTable::KeyHash::operator()(const Key& key) const noexcept
+{
+    uint64_t hash = key.size();
+
+    for (const Value &val : key)
+    {
+        hash = (hash ^ bitsOf(val) ^ static_cast<uint64_t>(val.getType()) << 56) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+
+    return static_cast<size_t>(hash);
+}
+
+bool MemoTable::KeyEqual::operator()(const Key& fst, const Key& snd) const noexcept
+{
+    if (fst.size() != snd.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < fst.size(); ++i)
+    {
+        if (fst[i].getType() != snd[i].getType() || bitsOf(fst[i]) != bitsOf(snd[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const Memo& Memo::of(const FunctionDefinition& function, const GlobalScope& globalScope)
+{
+    std::shared_ptr<Memo> &memo = function.memo;
+
+    if (!memo || memo->checkedEpoch != globalScope.getEpoch())
+    {
+        const EffectAnalysis::Function key(SymbolTable::intern(function.token.data), function.getArgc());
+        if (!memo || memo->version != globalScope.effects().versionOf(key))
+        {
+            memo = analyse(function, key, globalScope);
+        }
+        memo->checkedEpoch = globalScope.getEpoch();
+    }
+
+    return *memo;
+}
+
+std::shared_ptr<Memo> Memo::analyse(const FunctionDefinition& function, const EffectAnalysis::Function& key,
+                                    const GlobalScope& globalScope)
+{
+    std::shared_ptr<Memo> memo = std::make_shared<Memo>();
+    memo->version = globalScope.effects().versionOf(key);
+
+    // A redefined function which still runs is left alone
+    if (function.builtin || key.second == 0 || globalScope.findFunction(key.first, key.second) != &function ||
+        globalScope.effects().effectsOf(key, globalScope) != EffectAnalysis::PURE)
+    {
+        return memo;
+    }
+
+    // Greatest fixed point: the recursive calls first force every argument, which is
+    // narrowed until the body agrees
+    std::vector<bool> &forced = memo->forced;
+    forced.assign(key.second, true);
+    for (bool changed = true; changed;)
+    {
+        std::vector<bool> next(key.second);
+        markForced(function.definition.get(), globalScope, key, forced, next);
+        changed = next != forced;
+        forced.swap(next);
+    }
+
+    if (std::find(forced.begin(), forced.end(), false) == forced.end() &&
+        countCalls(function.definition.get(), globalScope, key.first, key.second) > 1)
+    {
+        memo->table = std::make_shared<MemoTable>();
+    }
+
+    return memo;
+}
+
+void Memo::forceArguments(const FunctionDefinition& function, FunctionScope& fncScp)
+{
+    // The arguments of a pure function are part of its body, so evaluating them earlier
+    // changes no output
+    const std::vector<bool> &forced = of(function, fncScp.getGlobalScope()).forced;
+
+    for (size_t i = 0; i < forced.size(); ++i)
+    {
+        if (forced[i])
+        {
+            fncScp.nth(i);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "interpreter.h"
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+
+//! Results of calls of a user function keyed by the evaluated arguments. Holds at most
+//! maxEntries results, the least recently used one is evicted first.
+class MemoTable
+{
+public:
+    //! Evaluated arguments of a call
+    typedef std::vector<Value> Key;
+
+    static const size_t maxEntries = 1 << 14;
+
+    //! Evaluates every argument of fncScp
+    static Key keyOf(const FunctionScope& fncScp);
+
+    //! The result stored for key or an empty value
+    Value find(const Key& key);
+    void insert(const Key& key, const Value& result);
+
+    size_t size() const noexcept { return index.size(); }
+
+private:
+    // Numbers are compared by their bits and lists by identity, so equal keys always
+    // stand for the same arguments, unlike eq() which compares within an epsilon
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const noexcept;
+    };
+    struct KeyEqual
+    {
+        bool operator()(const Key& fst, const Key& snd) const noexcept;
+    };
+
+    typedef std::list<std::pair<Key, Value>> Entries;
+
+    // Most recently used first
+    Entries entries;
+    std::unordered_map<Key, Entries::iterator, KeyHash, KeyEqual> index;
+
+};
+
+//! Decides whether calls of a user function are memoized. Only functions whose result
+//! depends on nothing but their arguments qualify: they are pure by EffectAnalysis and
+//! force every argument anyway, so computing the key changes nothing. Among those only
+//! functions which call themselves more than once are memoized, where the recursion
+//! recomputes the same calls.
+struct Memo
+{
+    //! Table of the function or nullptr if its calls are not memoized
+    std::shared_ptr<MemoTable> table;
+    //! Parameters which every evaluation of the body forces, empty unless the function is pure
+    std::vector<bool> forced;
+
+    //! Returns the up to date memo of a user function, analysing it again when the function
+    //! or a function it may call has been (re)defined since the last call
+    static const Memo& of(const FunctionDefinition& function, const GlobalScope& globalScope);
+
+    //! Evaluates the arguments in fncScp of a tail call of function by itself which the
+    //! function forces anyway, so accumulators never grow into chains of unevaluated arguments
+    static void forceArguments(const FunctionDefinition& function, FunctionScope& fncScp);
+
+private:
+    // EffectAnalysis::versionOf() the function had during the analysis
+    size_t version;
+    // GlobalScope::getEpoch() of the last check of the version
+    size_t checkedEpoch;
+
+    static std::shared_ptr<Memo> analyse(const FunctionDefinition& function, const EffectAnalysis::Function& key,
+                                         const GlobalScope& globalScope);
+
+};
@@ -0,0 +1,841 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+FusedPipelineNode::FusedPipelineNode(const std::shared_ptr<Node> &original, const std::shared_ptr<Node> &source,
+                                     const std::vector<Stage> &stages, Consumer consumer,
+                                     const std::shared_ptr<Node> &folder, const std::shared_ptr<Node> &init,
+                                     size_t libraryVersion)
+    : Node(original->token), original(original), source(source), stages(stages), consumer(consumer),
+      folder(folder), init(init), libraryVersion(libraryVersion)
+{
+    ;
+}
+
+//! True if node names a function with argc arguments which EffectAnalysis proves pure
+static bool isPureFunction(const Node* node, size_t argc, const GlobalScope &globalScope)
+{
+    const FunctionNameNode* name = dynamic_cast<const FunctionNameNode*>(node);
+
+    return name && globalScope.effects().effectsOf({name->value.asFunction(), argc}, globalScope) ==
+        EffectAnalysis::PURE;
+}
+
+bool FusedPipelineNode::isPure(const GlobalScope &globalScope) const
+{
+    for (const Stage &stage : stages)
+    {
+        if (!isPureFunction(stage.function.get(), 1, globalScope))
+        {
+            return false;
+        }
+    }
+
+    return consumer != Consumer::FOLDL || isPureFunction(folder.get(), 2, globalScope);
+}
+
+Value FusedPipelineNode::eval(FunctionScope &fncScp) const
+{
+    GlobalScope &globalScope = fncScp.getGlobalScope();
+
+    // The fusion hardcodes the behaviour of the pre-defined functions
+    if (globalScope.getLibraryVersion() != libraryVersion || !isPure(globalScope))
+    {
+        return original->eval(fncScp);
+    }
+
+    std::vector<FunctionCaller> callers;
+    callers.reserve(stages.size());
+    for (const Stage &stage : stages)
+    {
+        callers.push_back(FunctionCaller(globalScope, stage.function->eval(fncScp), 1,
+                                         stage.kind == Stage::Kind::MAP ? "map" : "filter"));
+    }
+
+    std::unique_ptr<FunctionCaller> fold;
+    Value acc;
+    if (consumer == Consumer::FOLDL)
+    {
+        fold.reset(new FunctionCaller(globalScope, folder->eval(fncScp), 2, "foldl"));
+        acc = init->eval(fncScp);
+    }
+
+    Value elements = Builtins::finiteList(source->eval(fncScp),
+                                          stages.front().kind == Stage::Kind::MAP ? "map" : "filter");
+
+    std::vector<Value> values;
+    int64_t count = 0;
+
+    for (const Value &element : elements.asList<ListLiteralValue>())
+    {
+        Value val = element;
+        bool keep = true;
+
+        for (size_t i = 0; i < stages.size() && keep; ++i)
+        {
+            if (stages[i].kind == Stage::Kind::MAP)
+            {
+                val = callers[i](val);
+            }
+            else
+            {
+                keep = Builtins::condition(callers[i](val));
+            }
+        }
+
+        if (!keep)
+        {
+            continue;
+        }
+
+        switch (consumer)
+        {
+        case Consumer::LIST:
+        case Consumer::SUM:
+            values.push_back(val);
+            break;
+        case Consumer::LENGTH:
+            ++count;
+            break;
+        case Consumer::FOLDL:
+            acc = (*fold)(acc, val);
+            break;
+        }
+    }
+
+    switch (consumer)
+    {
+    case Consumer::LIST:
+        return Value::makeList<ListLiteralValue>(std::move(values));
+    case Consumer::LENGTH:
+        return Value::makeInt(count);
+    case Consumer::SUM:
+        // Adds in the order of sum(), whose kernel runs several lanes
+        return Builtins::sum(Value::makeList<ListLiteralValue>(std::move(values)));
+    default:
+        return acc;
+    }
+}
+
+void FusedPipelineNode::print(std::ostream& out) const
+{
+    out << "{FusedPipelineNode: ";
+    original->print(out);
+    out << '}';
+}
+
+Value ConstantNode::eval(FunctionScope &fncScp) const
+{
+    if (fncScp.getGlobalScope().getLibraryVersion() != libraryVersion)
+    {
+        return original->eval(fncScp);
+    }
+
+    return value;
+}
+
+void ConstantNode::print(std::ostream& out) const
+{
+    out << "{ConstantNode: " << value.toString() << '}';
+}
+
+InlinedNode::InlinedNode(const std::shared_ptr<Node> &original, const std::shared_ptr<Node> &body, size_t symbol,
+                         size_t argc, const std::shared_ptr<Node> &calleeBody)
+    : Node(original->token), original(original), body(body), symbol(symbol), argc(argc), calleeBody(calleeBody),
+      valid(true), checkedEpoch(0)
+{
+    ;
+}
+
+bool InlinedNode::isValid(const GlobalScope &globalScope) const
+{
+    if (valid && checkedEpoch != globalScope.getEpoch())
+    {
+        const FunctionDefinition* function = globalScope.findFunction(symbol, argc);
+
+        valid = function && function->definition == calleeBody;
+        checkedEpoch = globalScope.getEpoch();
+    }
+
+    return valid;
+}
+
+Value InlinedNode::eval(FunctionScope &fncScp) const
+{
+    return tailNode(fncScp.getGlobalScope())->eval(fncScp);
+}
+
+const Node* InlinedNode::tailNode(const GlobalScope &globalScope) const
+{
+    return isValid(globalScope) ? body.get() : original.get();
+}
+
+void InlinedNode::print(std::ostream& out) const
+{
+    out << "{InlinedNode: ";
+    body->print(out);
+    out << '}';
+}
+
+//! Adds the inlined calls whose bodies TypeInference::typeOf() goes through for node to inlined
+static void collectInlined(const Node* node, std::vector<const InlinedNode*>& inlined)
+{
+    if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            collectInlined(arg.get(), inlined);
+        }
+    }
+    else if (const InlinedNode* inlinedNode = dynamic_cast<const InlinedNode*>(node))
+    {
+        inlined.push_back(inlinedNode);
+        collectInlined(inlinedNode->body.get(), inlined);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        collectInlined(arithmetic->original.get(), inlined);
+    }
+}
+
+SpecializedArithmeticNode::SpecializedArithmeticNode(const std::shared_ptr<FunctionApplication> &original,
+    Operation operation, bool isInt,
+    const std::vector<std::pair<TypeInference::Function, TypeInference::Type>> &assumptions, size_t libraryVersion)
+    : Node(original->token), original(original), fst(original->arguments[0]), snd(original->arguments[1]),
+      operation(operation), isInt(isInt), assumptions(assumptions), libraryVersion(libraryVersion),
+      valid(false), checkedEpoch(0)
+{
+    collectInlined(original.get(), inlined);
+}
+
+bool SpecializedArithmeticNode::isValid(const GlobalScope &globalScope) const
+{
+    if (checkedEpoch != globalScope.getEpoch())
+    {
+        valid = libraryVersion == globalScope.getLibraryVersion();
+        for (const std::pair<TypeInference::Function, TypeInference::Type> &assumption : assumptions)
+        {
+            // A function may become more precise, e.g. NONE once it always recurses
+            TypeInference::Type type = globalScope.types().returnTypeOf(assumption.first);
+            valid = valid && TypeInference::join(type, assumption.second) == assumption.second;
+        }
+        for (const InlinedNode* node : inlined)
+        {
+            valid = valid && node->isValid(globalScope);
+        }
+        checkedEpoch = globalScope.getEpoch();
+    }
+
+    return valid;
+}
+
+Value SpecializedArithmeticNode::eval(FunctionScope &fncScp) const
+{
+    if (!isValid(fncScp.getGlobalScope()))
+    {
+        return original->eval(fncScp);
+    }
+
+    Value fstVal = fst->eval(fncScp);
+    Value sndVal = snd->eval(fncScp);
+
+    if (isInt)
+    {
+        switch (operation)
+        {
+        case Operation::ADD:
+            return Value::makeInt(Builtins::add(fstVal.asInt(), sndVal.asInt()));
+        case Operation::SUB:
+            return Value::makeInt(Builtins::sub(fstVal.asInt(), sndVal.asInt()));
+        default:
+            return Value::makeInt(Builtins::mul(fstVal.asInt(), sndVal.asInt()));
+        }
+    }
+
+    switch (operation)
+    {
+    case Operation::ADD:
+        return Value::makeReal(Builtins::add(fstVal.asReal(), sndVal.asReal()));
+    case Operation::SUB:
+        return Value::makeReal(Builtins::sub(fstVal.asReal(), sndVal.asReal()));
+    default:
+        return Value::makeReal(Builtins::mul(fstVal.asReal(), sndVal.asReal()));
+    }
+}
+
+void SpecializedArithmeticNode::print(std::ostream& out) const
+{
+    out << "{SpecializedArithmeticNode: ";
+    original->print(out);
+    out << '}';
+}
+
+//! Number of nodes of the expression
+static size_t sizeOf(const Node* node)
+{
+    size_t size = 1;
+
+    if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            size += sizeOf(arg.get());
+        }
+    }
+    else if (const ListLiteralNode* list = dynamic_cast<const ListLiteralNode*>(node))
+    {
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            size += sizeOf(item.get());
+        }
+    }
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        size = sizeOf(inlined->body.get());
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        size = sizeOf(arithmetic->original.get());
+    }
+    else if (dynamic_cast<const FusedPipelineNode*>(node))
+    {
+        // Never worth copying
+        size = std::string::npos;
+    }
+
+    return size;
+}
+
+//! True if the expression calls the function symbol
+static bool callsSymbol(const Node* node, size_t symbol)
+{
+    if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        return call->symbol == symbol ||
+               std::any_of(call->arguments.begin(), call->arguments.end(),
+                           [symbol](const std::shared_ptr<Node> &arg) { return callsSymbol(arg.get(), symbol); });
+    }
+    else if (const ListLiteralNode* list = dynamic_cast<const ListLiteralNode*>(node))
+    {
+        return std::any_of(list->contents.begin(), list->contents.end(),
+                           [symbol](const std::shared_ptr<Node> &item) { return callsSymbol(item.get(), symbol); });
+    }
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        return callsSymbol(inlined->body.get(), symbol);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        return callsSymbol(arithmetic->original.get(), symbol);
+    }
+
+    return false;
+}
+
+//! Adds the number of occurrences of every #idx in the expression to uses
+static void countUses(const Node* node, std::vector<size_t>& uses)
+{
+    if (const ArgumentNode* arg = dynamic_cast<const ArgumentNode*>(node))
+    {
+        ++uses[arg->index];
+    }
+    else if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            countUses(arg.get(), uses);
+        }
+    }
+    else if (const ListLiteralNode* list = dynamic_cast<const ListLiteralNode*>(node))
+    {
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            countUses(item.get(), uses);
+        }
+    }
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        countUses(inlined->body.get(), uses);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        countUses(arithmetic->original.get(), uses);
+    }
+}
+
+//! Copy of body with every #idx replaced by arguments[idx]. Parts without parameters are
+//! shared. Returns nullptr if body holds nodes which can't be copied.
+static std::shared_ptr<Node> substitute(const std::shared_ptr<Node>& body,
+                                        const std::vector<std::shared_ptr<Node>>& arguments)
+{
+    if (body->getArgc() == 0)
+    {
+        return body;
+    }
+    else if (std::shared_ptr<ArgumentNode> arg = std::dynamic_pointer_cast<ArgumentNode>(body))
+    {
+        return arguments[arg->index];
+    }
+    else if (std::shared_ptr<FunctionApplication> call = std::dynamic_pointer_cast<FunctionApplication>(body))
+    {
+        std::vector<std::shared_ptr<Node>> substituted;
+        for (const std::shared_ptr<Node> &item : call->arguments)
+        {
+            substituted.push_back(substitute(item, arguments));
+            if (!substituted.back())
+            {
+                return nullptr;
+            }
+        }
+
+        return std::make_shared<FunctionApplication>(call->token, substituted);
+    }
+    else if (std::shared_ptr<ListLiteralNode> list = std::dynamic_pointer_cast<ListLiteralNode>(body))
+    {
+        std::vector<std::shared_ptr<Node>> substituted;
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            substituted.push_back(substitute(item, arguments));
+            if (!substituted.back())
+            {
+                return nullptr;
+            }
+        }
+
+        return std::make_shared<ListLiteralNode>(list->token, substituted);
+    }
+    else if (std::shared_ptr<InlinedNode> inlined = std::dynamic_pointer_cast<InlinedNode>(body))
+    {
+        std::shared_ptr<Node> original = substitute(inlined->original, arguments);
+        std::shared_ptr<Node> inlinedBody = substitute(inlined->body, arguments);
+        if (!original || !inlinedBody)
+        {
+            return nullptr;
+        }
+
+        return std::make_shared<InlinedNode>(original, inlinedBody, inlined->symbol, inlined->argc,
+                                             inlined->calleeBody);
+    }
+    else if (std::shared_ptr<SpecializedArithmeticNode> arithmetic =
+             std::dynamic_pointer_cast<SpecializedArithmeticNode>(body))
+    {
+        // The operand types may differ in the new context, it is specialized again
+        return substitute(arithmetic->original, arguments);
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<Node> Optimizer::optimize(const std::shared_ptr<Node>& ast, GlobalScope& globalScope)
+{
+    Optimizer optimizer(globalScope);
+    std::shared_ptr<Node> optimized = optimizer.rewrite(ast);
+
+    // A definition is typed with its new body, which calls of the function refer to
+    if (std::shared_ptr<FunctionDefinition> definition = std::dynamic_pointer_cast<FunctionDefinition>(optimized))
+    {
+        TypeInference types(globalScope, {SymbolTable::intern(definition->token.data), definition->getArgc()},
+                            definition->definition.get());
+        std::shared_ptr<Node> body = optimizer.specialize(definition->definition, types);
+
+        return body == definition->definition ? definition
+                                              : std::make_shared<FunctionDefinition>(definition->token, body);
+    }
+
+    TypeInference types(globalScope);
+
+    return optimizer.specialize(optimized, types);
+}
+
+std::shared_ptr<Node> Optimizer::rewrite(const std::shared_ptr<Node>& node)
+{
+    if (std::shared_ptr<FunctionDefinition> definition = std::dynamic_pointer_cast<FunctionDefinition>(node))
+    {
+        const size_t enclosing = definedSymbol;
+        definedSymbol = SymbolTable::intern(definition->token.data);
+        std::shared_ptr<Node> body = rewrite(definition->definition);
+        definedSymbol = enclosing;
+
+        if (body != definition->definition)
+        {
+            return std::make_shared<FunctionDefinition>(definition->token, body);
+        }
+    }
+    else if (std::shared_ptr<FunctionApplication> call = std::dynamic_pointer_cast<FunctionApplication>(node))
+    {
+        if (std::shared_ptr<Node> fused = fuse(call))
+        {
+            return fused;
+        }
+
+        std::vector<std::shared_ptr<Node>> arguments;
+        bool changed = false;
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            // Operands which may never run are still inlined and fused, but not folded
+            const bool skippable = isSkippable(call, arguments, arguments.size());
+            skippableDepth += skippable;
+            arguments.push_back(rewrite(arg));
+            skippableDepth -= skippable;
+            changed = changed || arguments.back() != arg;
+        }
+
+        if (changed)
+        {
+            call = std::make_shared<FunctionApplication>(call->token, arguments);
+        }
+
+        if (std::shared_ptr<Node> folded = fold(call))
+        {
+            return folded;
+        }
+        else if (std::shared_ptr<Node> inlined = inlineCall(call))
+        {
+            return inlined;
+        }
+
+        return call;
+    }
+    else if (std::shared_ptr<ListLiteralNode> list = std::dynamic_pointer_cast<ListLiteralNode>(node))
+    {
+        std::vector<std::shared_ptr<Node>> contents;
+        std::vector<Value> values;
+        bool changed = false;
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            contents.push_back(rewrite(item));
+            changed = changed || contents.back() != item;
+            values.push_back(constantOf(contents.back()));
+        }
+
+        // Lists are immutable, so a list of constants is built once
+        if (std::all_of(values.begin(), values.end(), [](const Value &val) { return bool(val); }))
+        {
+            return std::make_shared<ConstantNode>(Value::makeList<ListLiteralValue>(std::move(values)), list,
+                                                  globalScope.getLibraryVersion());
+        }
+        else if (changed)
+        {
+            return std::make_shared<ListLiteralNode>(list->token, contents);
+        }
+    }
+
+    return node;
+}
+
+std::shared_ptr<Node> Optimizer::fuse(const std::shared_ptr<FunctionApplication>& node)
+{
+    FusedPipelineNode::Consumer consumer = FusedPipelineNode::Consumer::LIST;
+    std::shared_ptr<Node> chain = node;
+    std::shared_ptr<Node> folder;
+    std::shared_ptr<Node> init;
+
+    if (callsBuiltin(node, "length", 1))
+    {
+        consumer = FusedPipelineNode::Consumer::LENGTH;
+        chain = node->arguments[0];
+    }
+    else if (callsBuiltin(node, "sum", 1))
+    {
+        consumer = FusedPipelineNode::Consumer::SUM;
+        chain = node->arguments[0];
+    }
+    else if (callsBuiltin(node, "foldl", 3))
+    {
+        consumer = FusedPipelineNode::Consumer::FOLDL;
+        folder = rewrite(node->arguments[0]);
+        init = rewrite(node->arguments[1]);
+        chain = node->arguments[2];
+    }
+
+    // Collects the stages from the outermost one
+    std::vector<FusedPipelineNode::Stage> stages;
+    while (std::shared_ptr<FunctionApplication> call = std::dynamic_pointer_cast<FunctionApplication>(chain))
+    {
+        if (callsBuiltin(call, "map", 2))
+        {
+            stages.push_back({FusedPipelineNode::Stage::Kind::MAP, rewrite(call->arguments[0])});
+        }
+        else if (callsBuiltin(call, "filter", 2))
+        {
+            stages.push_back({FusedPipelineNode::Stage::Kind::FILTER, rewrite(call->arguments[0])});
+        }
+        else
+        {
+            break;
+        }
+
+        chain = call->arguments[1];
+    }
+
+    // A single map() or filter() which builds a list is already a single loop
+    if (stages.empty() || (consumer == FusedPipelineNode::Consumer::LIST && stages.size() < 2))
+    {
+        return nullptr;
+    }
+
+    // Calls of the stages are interleaved, which only pure functions don't notice
+    if (std::any_of(stages.begin(), stages.end(), [this](const FusedPipelineNode::Stage &stage)
+                    { return !isPureFunction(stage.function.get(), 1, globalScope); }) ||
+        (folder && !isPureFunction(folder.get(), 2, globalScope)))
+    {
+        return nullptr;
+    }
+
+    std::reverse(stages.begin(), stages.end());
+
+    return std::make_shared<FusedPipelineNode>(node, rewrite(chain), stages, consumer, folder, init,
+                                               globalScope.getLibraryVersion());
+}
+
+std::shared_ptr<Node> Optimizer::fold(const std::shared_ptr<FunctionApplication>& node)
+{
+    // Builtins which neither do input or output nor call user functions
+    static const char* const pure[] = {
+        "eq", "le", "nand", "length", "head", "tail", "concat", "if", "int", "add", "sub", "mul",
+        "div", "mod", "sqrt", "list", "sum", "sort", "nth", "take", "drop", "slice", "last",
+        "product", "dot", "min", "max", "vadd", "vsub", "vmul", "vdiv", "vsqrt", "indexOf", "contains"
+    };
+
+    const FunctionDefinition* function = globalScope.findFunction(node->symbol, node->arguments.size());
+    if (skippableDepth || !function || !function->builtin ||
+        std::none_of(std::begin(pure), std::end(pure),
+                     [&node](const char* name) { return node->token.data == name; }))
+    {
+        return nullptr;
+    }
+
+    for (const std::shared_ptr<Node> &arg : node->arguments)
+    {
+        Value val = constantOf(arg);
+        if (!val || (val.getType() == Value::Type::LIST_LITERAL &&
+                     val.asList<ListLiteralValue>().size() > maxFoldedLength))
+        {
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<FunctionScope> scope = std::make_shared<FunctionScope>(
+        globalScope, nullptr, std::vector<std::shared_ptr<Node>>());
+    try
+    {
+        return std::make_shared<ConstantNode>(node->eval(*scope), node, globalScope.getLibraryVersion());
+    }
+    catch (const std::runtime_error&)
+    {
+        return nullptr;
+    }
+}
+
+bool Optimizer::isSkippable(const std::shared_ptr<FunctionApplication>& node,
+                            const std::vector<std::shared_ptr<Node>>& arguments, size_t idx) const
+{
+    const bool isIf = callsBuiltin(node, "if", 3);
+    if (idx == 0 || (!isIf && !callsBuiltin(node, "nand", 2)))
+    {
+        return false;
+    }
+
+    Value condition = constantOf(arguments[0]);
+    if (!condition)
+    {
+        return true;
+    }
+
+    try
+    {
+        // nand() evaluates its second operand only after a true first one
+        return isIf ? Builtins::condition(condition) != (idx == 1) : !Builtins::nandOperand(condition);
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+}
+
+std::shared_ptr<Node> Optimizer::inlineCall(const std::shared_ptr<FunctionApplication>& node)
+{
+    const FunctionDefinition* function = globalScope.findFunction(node->symbol, node->arguments.size());
+    if (!function || function->builtin || node->symbol == definedSymbol || inliningDepth >= maxInliningDepth ||
+        sizeOf(function->definition.get()) > maxInlinedSize || callsSymbol(function->definition.get(), node->symbol))
+    {
+        return nullptr;
+    }
+
+    // Arguments are evaluated at most once, so an argument which isn't a parameter or a constant
+    // may be substituted only where it is used once
+    std::vector<size_t> uses(node->arguments.size());
+    countUses(function->definition.get(), uses);
+    for (size_t i = 0; i < uses.size(); ++i)
+    {
+        if (uses[i] > 1 && !constantOf(node->arguments[i]) &&
+            !std::dynamic_pointer_cast<ArgumentNode>(node->arguments[i]))
+        {
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<Node> body = substitute(function->definition, node->arguments);
+    if (!body)
+    {
+        return nullptr;
+    }
+
+    // The substituted constants may fold further
+    ++inliningDepth;
+    body = rewrite(body);
+    --inliningDepth;
+
+    return std::make_shared<InlinedNode>(node, body, node->symbol, node->arguments.size(), function->definition);
+}
+
+//! Adds the return types of the user functions node calls to assumptions
+static void assumeReturnTypes(const Node* node, TypeInference& types,
+                              std::vector<std::pair<TypeInference::Function, TypeInference::Type>>& assumptions)
+{
+    if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        const TypeInference::Function function(call->symbol, call->arguments.size());
+        if (types.bodyOf(function) &&
+            std::none_of(assumptions.begin(), assumptions.end(),
+                         [&function](const std::pair<TypeInference::Function, TypeInference::Type> &assumption)
+                         { return assumption.first == function; }))
+        {
+            assumptions.push_back({function, types.returnTypeOf(function)});
+        }
+
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            assumeReturnTypes(arg.get(), types, assumptions);
+        }
+    }
+    else if (const ListLiteralNode* list = dynamic_cast<const ListLiteralNode*>(node))
+    {
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            assumeReturnTypes(item.get(), types, assumptions);
+        }
+    }
+    // Once the inlined function is redefined the original call is evaluated instead
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        assumeReturnTypes(inlined->original.get(), types, assumptions);
+        assumeReturnTypes(inlined->body.get(), types, assumptions);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        assumeReturnTypes(arithmetic->original.get(), types, assumptions);
+    }
+}
+
+std::shared_ptr<Node> Optimizer::specialize(const std::shared_ptr<Node>& node, TypeInference& types)
+{
+    if (std::shared_ptr<FunctionApplication> call = std::dynamic_pointer_cast<FunctionApplication>(node))
+    {
+        std::vector<std::shared_ptr<Node>> arguments;
+        bool changed = false;
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            arguments.push_back(specialize(arg, types));
+            changed = changed || arguments.back() != arg;
+        }
+
+        if (changed)
+        {
+            call = std::make_shared<FunctionApplication>(call->token, arguments);
+        }
+
+        SpecializedArithmeticNode::Operation operation;
+        if (callsBuiltin(call, "add", 2))
+        {
+            operation = SpecializedArithmeticNode::Operation::ADD;
+        }
+        else if (callsBuiltin(call, "sub", 2))
+        {
+            operation = SpecializedArithmeticNode::Operation::SUB;
+        }
+        else if (callsBuiltin(call, "mul", 2))
+        {
+            operation = SpecializedArithmeticNode::Operation::MUL;
+        }
+        else
+        {
+            return call;
+        }
+
+        TypeInference::Type type = types.typeOf(call->arguments[0].get());
+        if ((type != TypeInference::Type::INT && type != TypeInference::Type::REAL) ||
+            types.typeOf(call->arguments[1].get()) != type)
+        {
+            return call;
+        }
+
+        std::vector<std::pair<TypeInference::Function, TypeInference::Type>> assumptions;
+        assumeReturnTypes(call.get(), types, assumptions);
+
+        return std::make_shared<SpecializedArithmeticNode>(call, operation, type == TypeInference::Type::INT,
+                                                           assumptions, globalScope.getLibraryVersion());
+    }
+    else if (std::shared_ptr<ListLiteralNode> list = std::dynamic_pointer_cast<ListLiteralNode>(node))
+    {
+        std::vector<std::shared_ptr<Node>> contents;
+        bool changed = false;
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            contents.push_back(specialize(item, types));
+            changed = changed || contents.back() != item;
+        }
+
+        if (changed)
+        {
+            return std::make_shared<ListLiteralNode>(list->token, contents);
+        }
+    }
+    else if (std::shared_ptr<InlinedNode> inlined = std::dynamic_pointer_cast<InlinedNode>(node))
+    {
+        std::shared_ptr<Node> body = specialize(inlined->body, types);
+        if (body != inlined->body)
+        {
+            return std::make_shared<InlinedNode>(inlined->original, body, inlined->symbol, inlined->argc,
+                                                 inlined->calleeBody);
+        }
+    }
+
+    return node;
+}
+
+Value Optimizer::constantOf(const std::shared_ptr<Node>& node)
+{
+    if (std::shared_ptr<ConstantNode> constant = std::dynamic_pointer_cast<ConstantNode>(node))
+    {
+        return constant->value;
+    }
+    else if (std::shared_ptr<IntNode> literal = std::dynamic_pointer_cast<IntNode>(node))
+    {
+        return literal->value;
+    }
+    else if (std::shared_ptr<DoubleNode> literal = std::dynamic_pointer_cast<DoubleNode>(node))
+    {
+        return literal->value;
+    }
+    else if (std::shared_ptr<FunctionNameNode> literal = std::dynamic_pointer_cast<FunctionNameNode>(node))
+    {
+        return literal->value;
+    }
+
+    return Value();
+}
+
+bool Optimizer::callsBuiltin(const std::shared_ptr<FunctionApplication>& node, const char* name, size_t argc) const
+{
+    if (node->arguments.size() != argc || node->token.data != name)
+    {
+        return false;
+    }
+
+    const FunctionDefinition* function = globalScope.findFunction(node->symbol, argc);
+
+    return function && function->builtin;
+}
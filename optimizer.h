@@ -0,0 +1,221 @@
+#pragma once
+
+#include "parser.h"
+#include "interpreter.h"
+#include "type_inference.h"
+
+
+//! Chain of map() and filter() with a consumer, evaluated as a single loop without
+//! building the intermediate lists. E.g. length(filter(f, map(g, #0))).
+struct FusedPipelineNode : public Node
+{
+    //! Step of the pipeline applied to every element
+    struct Stage
+    {
+        enum class Kind
+        {
+            MAP,
+            FILTER,
+        };
+
+        Kind kind;
+        std::shared_ptr<Node> function;
+    };
+
+    //! What is done with the elements which pass all stages
+    enum class Consumer
+    {
+        LIST,   // Collects them into a list
+        LENGTH,
+        SUM,
+        FOLDL,
+    };
+
+    //! The expression which was fused. Evaluated instead if the default library changes or a
+    //! stage or the folder may no longer be pure.
+    const std::shared_ptr<Node> original;
+    const std::shared_ptr<Node> source;
+    //! In the order they are applied
+    const std::vector<Stage> stages;
+    const Consumer consumer;
+    //! Function and initial value of FOLDL
+    const std::shared_ptr<Node> folder;
+    const std::shared_ptr<Node> init;
+    //! GlobalScope::getLibraryVersion() at the time of fusion
+    const size_t libraryVersion;
+
+    FusedPipelineNode(const std::shared_ptr<Node> &original, const std::shared_ptr<Node> &source,
+                      const std::vector<Stage> &stages, Consumer consumer, const std::shared_ptr<Node> &folder,
+                      const std::shared_ptr<Node> &init, size_t libraryVersion);
+
+    //! Runs the fused loop
+    Value eval(FunctionScope &fncScp) const override;
+
+    //! True if every stage and the folder name functions which EffectAnalysis proves pure, so
+    //! running the stages element by element changes nothing but the speed
+    bool isPure(const GlobalScope &globalScope) const;
+
+    //! Prints the original expression.
+    void print(std::ostream& out) const override;
+
+    size_t getArgc() const override
+    {
+        return original->getArgc();
+    }
+};
+
+//! Value of an expression which was computed by the optimizer, e.g. sqrt(5)
+struct ConstantNode : public Node
+{
+    const Value value;
+    //! The folded expression. Evaluated instead if the default library changes.
+    const std::shared_ptr<Node> original;
+    //! GlobalScope::getLibraryVersion() at the time of folding
+    const size_t libraryVersion;
+
+    ConstantNode(const Value &value, const std::shared_ptr<Node> &original, size_t libraryVersion)
+        : Node(original->token), value(value), original(original), libraryVersion(libraryVersion) {}
+
+    Value eval(FunctionScope &fncScp) const override;
+
+    //! Prints the value.
+    void print(std::ostream& out) const override;
+
+    size_t getArgc() const override
+    {
+        return original->getArgc();
+    }
+};
+
+//! Call of a small user defined function replaced by its body, in which the parameters are
+//! replaced by the arguments of the call
+struct InlinedNode : public Node
+{
+    const std::shared_ptr<Node> original;
+    const std::shared_ptr<Node> body;
+    // The inlined definition, which is kept alive so a redefinition never has the same address
+    const size_t symbol;
+    const size_t argc;
+    const std::shared_ptr<Node> calleeBody;
+
+    InlinedNode(const std::shared_ptr<Node> &original, const std::shared_ptr<Node> &body, size_t symbol,
+                size_t argc, const std::shared_ptr<Node> &calleeBody);
+
+    //! False once the inlined function is redefined, original is then evaluated instead
+    bool isValid(const GlobalScope &globalScope) const;
+
+    Value eval(FunctionScope &fncScp) const override;
+
+    const Node* tailNode(const GlobalScope &globalScope) const override;
+
+    //! Prints the inlined body.
+    void print(std::ostream& out) const override;
+
+    size_t getArgc() const override
+    {
+        return original->getArgc();
+    }
+
+private:
+    mutable bool valid;
+    mutable size_t checkedEpoch;
+};
+
+//! Call of add(), sub() or mul() whose operands are proven to be both ints or both reals,
+//! so the result is computed without checking their types
+struct SpecializedArithmeticNode : public Node
+{
+    enum class Operation
+    {
+        ADD,
+        SUB,
+        MUL,
+    };
+
+    //! The specialized call. Evaluated instead once the proof no longer holds.
+    const std::shared_ptr<Node> original;
+    const std::shared_ptr<Node> fst;
+    const std::shared_ptr<Node> snd;
+    const Operation operation;
+    //! Both operands are ints, otherwise both are reals
+    const bool isInt;
+    //! Return types of the user functions the proof relies on
+    const std::vector<std::pair<TypeInference::Function, TypeInference::Type>> assumptions;
+    //! GlobalScope::getLibraryVersion() at the time of the proof
+    const size_t libraryVersion;
+
+    SpecializedArithmeticNode(const std::shared_ptr<FunctionApplication> &original, Operation operation, bool isInt,
+                              const std::vector<std::pair<TypeInference::Function, TypeInference::Type>> &assumptions,
+                              size_t libraryVersion);
+
+    //! False once a pre-defined function is redefined, a function the proof relies on
+    //! may return another type or a function inlined into the operands is redefined
+    bool isValid(const GlobalScope &globalScope) const;
+
+    Value eval(FunctionScope &fncScp) const override;
+
+    //! Prints the original call.
+    void print(std::ostream& out) const override;
+
+    size_t getArgc() const override
+    {
+        return original->getArgc();
+    }
+
+private:
+    // Inlined calls in the operands whose bodies the proof went through, owned by original
+    std::vector<const InlinedNode*> inlined;
+    mutable bool valid;
+    mutable size_t checkedEpoch;
+};
+
+//! Rewrites parsed expressions before they are evaluated
+class Optimizer
+{
+public:
+    //! Returns ast with calls of pure builtins on constants folded, small functions inlined,
+    //! chains of list builtins fused into single loops and arithmetic on proven types
+    //! specialized. Function definitions are rewritten as a whole, so their bodies are
+    //! optimized once.
+    static std::shared_ptr<Node> optimize(const std::shared_ptr<Node>& ast, GlobalScope& globalScope);
+
+private:
+    // Bodies of at most this many nodes are inlined
+    static const size_t maxInlinedSize = 12;
+    // Inlined bodies are optimized again, which may inline the functions they call
+    static const size_t maxInliningDepth = 4;
+    // Calls with longer constant lists are left to run when they are evaluated, sorting
+    // or summing them could take long
+    static const size_t maxFoldedLength = 1 << 12;
+
+    GlobalScope& globalScope;
+    // The function whose definition is rewritten, it is never inlined into itself
+    size_t definedSymbol;
+    size_t inliningDepth;
+    // Number of enclosing operands which may never be evaluated, nothing is folded inside them
+    size_t skippableDepth;
+
+    explicit Optimizer(GlobalScope& globalScope)
+        : globalScope(globalScope), definedSymbol(std::string::npos), inliningDepth(0), skippableDepth(0) {}
+
+    std::shared_ptr<Node> rewrite(const std::shared_ptr<Node>& node);
+    //! Returns the fused pipeline which ends with node or nullptr
+    std::shared_ptr<Node> fuse(const std::shared_ptr<FunctionApplication>& node);
+    //! Returns the value of a call of a pure builtin with constant arguments as a ConstantNode
+    //! or nullptr. Calls which throw are left to fail when they are evaluated.
+    std::shared_ptr<Node> fold(const std::shared_ptr<FunctionApplication>& node);
+    //! True if the argument idx of node may not be evaluated: a branch of if() or the second
+    //! operand of nand() which a constant condition, among the rewritten arguments, doesn't select
+    bool isSkippable(const std::shared_ptr<FunctionApplication>& node,
+                     const std::vector<std::shared_ptr<Node>>& arguments, size_t idx) const;
+    //! Returns the call of a small non-recursive user function as an InlinedNode or nullptr
+    std::shared_ptr<Node> inlineCall(const std::shared_ptr<FunctionApplication>& node);
+    //! Replaces the calls of add(), sub() and mul() in node whose operand types are proven
+    //! by types with SpecializedArithmeticNodes. Runs after rewrite(), which may change them.
+    std::shared_ptr<Node> specialize(const std::shared_ptr<Node>& node, TypeInference& types);
+    //! True if node calls the pre-defined function name with argc arguments
+    bool callsBuiltin(const std::shared_ptr<FunctionApplication>& node, const char* name, size_t argc) const;
+    //! The value of literals and folded nodes, otherwise an empty value
+    static Value constantOf(const std::shared_ptr<Node>& node);
+
+};
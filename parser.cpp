@@ -1,5 +1,6 @@
 #include "parser.h"
 #include "interpreter.h"
+#include "memo.h"
 
 
 
@@ -15,40 +16,47 @@ void Node::print(std::ostream& out) const
 }
 
 IntNode::IntNode(Token token)
-    : Node(token)
+    : Node(token), value(Value::makeInt(std::stoll(token.data)))
 {
     ;
 }
 
-std::shared_ptr<Value> IntNode::eval(FunctionScope &fncScp) const
+Value IntNode::eval(FunctionScope &fncScp) const
 {
-    return std::dynamic_pointer_cast<Value>(
-        std::make_shared<IntValue>(std::stoi(token.data))
-    );
+    return value;
+}
+
+FunctionNameNode::FunctionNameNode(Token token)
+    : Node(token), value(Value::makeFunction(SymbolTable::intern(token.data)))
+{
+    ;
+}
+
+Value FunctionNameNode::eval(FunctionScope &) const
+{
+    return value;
 }
 
 DoubleNode::DoubleNode(Token token)
-    : Node(token)
+    : Node(token), value(Value::makeReal(std::stod(token.data)))
 {
     ;
 }
 
-std::shared_ptr<Value> DoubleNode::eval(FunctionScope &fncScp) const
+Value DoubleNode::eval(FunctionScope &fncScp) const
 {
-    return std::dynamic_pointer_cast<Value>(
-        std::make_shared<RealValue>(std::stod(token.data))
-    );
+    return value;
 }
 
 ArgumentNode::ArgumentNode(Token token)
-    : Node(token)
+    : Node(token), index(std::stoi(token.data))
 {
     ;
 }
 
-std::shared_ptr<Value> ArgumentNode::eval(FunctionScope &fncScp) const
+Value ArgumentNode::eval(FunctionScope &fncScp) const
 {
-    return fncScp.nth(std::stoi(token.data));
+    return fncScp.nth(index);
 }
 
 ListLiteralNode::ListLiteralNode(Token token, const std::vector<std::shared_ptr<Node>> &contents)
@@ -57,18 +65,17 @@ ListLiteralNode::ListLiteralNode(Token token, const std::vector<std::shared_ptr<
     ;
 }
 
-std::shared_ptr<Value> ListLiteralNode::eval(FunctionScope &fncScp) const
+Value ListLiteralNode::eval(FunctionScope &fncScp) const
 {
-    std::vector<std::shared_ptr<Value>> list;
+    std::vector<Value> list;
+    list.reserve(contents.size());
 
     for (std::shared_ptr<Node> item : contents)
     {
         list.push_back(item->eval(fncScp));
     }
 
-    return std::dynamic_pointer_cast<Value>(
-        std::make_shared<ListLiteralValue>(list)
-    );
+    return Value::makeList<ListLiteralValue>(std::move(list));
 }
 
 void ListLiteralNode::print(std::ostream& out) const
@@ -83,11 +90,16 @@ void ListLiteralNode::print(std::ostream& out) const
 	out << '}';
 }
 
-std::shared_ptr<Value> FunctionDefinition::eval(FunctionScope &fncScp) const
+FunctionDefinition::FunctionDefinition(Token token, const std::shared_ptr<Node> definition)
+    : Node(token), definition(definition),
+      builtin(dynamic_cast<const DefaultFunctionNode*>(definition.get()))
 {
-    return std::dynamic_pointer_cast<Value>(std::make_shared<IntValue>(
-        (int)fncScp.getGlobalScope().addFunction(std::make_shared<FunctionDefinition>(*this))
-    ));
+    ;
+}
+
+Value FunctionDefinition::eval(FunctionScope &fncScp) const
+{
+    return Value::makeInt(fncScp.getGlobalScope().addFunction(std::make_shared<FunctionDefinition>(*this)));
 }
 
 void FunctionDefinition::print(std::ostream& out) const
@@ -100,11 +112,142 @@ void FunctionDefinition::print(std::ostream& out) const
 	out << '}';
 }
 
-std::shared_ptr<Value> FunctionApplication::eval(FunctionScope &parentScope) const
+FunctionApplication::FunctionApplication(Token token, const std::vector<std::shared_ptr<Node>> &arguments)
+    : Node(token), arguments(arguments), symbol(SymbolTable::intern(token.data)),
+      target(nullptr), targetEpoch(0)
 {
-    FunctionScope localScope(parentScope.getGlobalScope(), std::make_shared<FunctionScope>(parentScope), arguments);
-    
-    return parentScope.getGlobalScope().callFunction(token.data, localScope);
+    for (const std::shared_ptr<Node> &arg : arguments)
+    {
+        std::shared_ptr<ArgumentNode> forwarded = std::dynamic_pointer_cast<ArgumentNode>(arg);
+        forwardedArguments.push_back(forwarded ? forwarded->index : std::string::npos);
+    }
+}
+
+const FunctionDefinition& FunctionApplication::resolve(const GlobalScope &globalScope) const
+{
+    if (targetEpoch != globalScope.getEpoch())
+    {
+        target = globalScope.findFunction(symbol, arguments.size());
+        targetEpoch = globalScope.getEpoch();
+    }
+
+    if (!target)
+    {
+        throw std::runtime_error("Called function which is not defined");
+    }
+
+    return *target;
+}
+
+std::shared_ptr<FunctionScope> FunctionApplication::makeScope(GlobalScope &globalScope,
+    const std::shared_ptr<FunctionScope> &callerScope) const
+{
+    std::vector<std::shared_ptr<Thunk>> thunks;
+    thunks.reserve(arguments.size());
+
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        std::shared_ptr<Thunk> thunk;
+        if (forwardedArguments[i] != std::string::npos && callerScope)
+        {
+            thunk = callerScope->getThunk(forwardedArguments[i]);
+        }
+
+        thunks.push_back(thunk ? std::move(thunk) : std::make_shared<Thunk>(arguments[i], callerScope));
+    }
+
+    return std::make_shared<FunctionScope>(globalScope, std::move(thunks));
+}
+
+Value FunctionApplication::eval(FunctionScope &parentScope) const
+{
+    static const size_t ifSymbol = SymbolTable::intern("if");
+
+    GlobalScope &globalScope = parentScope.getGlobalScope();
+    const FunctionApplication* call = this;
+    // The arguments keep the caller alive through shared ownership instead of a copy of it
+    std::shared_ptr<FunctionScope> callerScope = parentScope.shared_from_this();
+    // Memoized calls passed by the loop, all of them have its result
+    std::vector<std::pair<std::shared_ptr<MemoTable>, MemoTable::Key>> memoized;
+    // User function whose body the loop continues in
+    const FunctionDefinition* running = nullptr;
+    Value res;
+
+    // Calls in tail position of a user defined function, including the branches of if(),
+    // continue this loop instead of growing the C++ stack
+    while (!res)
+    {
+        const FunctionDefinition &function = call->resolve(globalScope);
+
+        if (function.builtin)
+        {
+            std::shared_ptr<FunctionScope> localScope = std::make_shared<FunctionScope>(
+                globalScope, callerScope, call->arguments);
+
+            res = function.builtin->eval(*localScope);
+            break;
+        }
+
+        std::shared_ptr<FunctionScope> localScope = call->makeScope(globalScope, callerScope);
+        const Node* body = function.definition.get();
+
+        if (&function == running)
+        {
+            Memo::forceArguments(function, *localScope);
+        }
+        running = &function;
+
+        if (std::shared_ptr<MemoTable> memo = globalScope.memoOf(function))
+        {
+            MemoTable::Key key = MemoTable::keyOf(*localScope);
+            res = memo->find(key);
+            if (res)
+            {
+                break;
+            }
+            memoized.emplace_back(std::move(memo), std::move(key));
+        }
+
+        for (call = nullptr; !call && !res;)
+        {
+            while (const Node* inner = body->tailNode(globalScope))
+            {
+                body = inner;
+            }
+
+            const FunctionApplication* app = dynamic_cast<const FunctionApplication*>(body);
+            if (!app)
+            {
+                res = body->eval(*localScope);
+                break;
+            }
+
+            const FunctionDefinition &next = app->resolve(globalScope);
+            if (!next.builtin)
+            {
+                call = app;
+            }
+            else if (app->symbol == ifSymbol && app->arguments.size() == 3)
+            {
+                // Same as ifFunc(), the arguments would be evaluated in localScope anyway
+                bool condition = Builtins::condition(app->arguments[0]->eval(*localScope));
+                body = app->arguments[condition ? 1 : 2].get();
+            }
+            else
+            {
+                res = app->eval(*localScope);
+            }
+        }
+
+        callerScope = std::move(localScope);
+    }
+
+    for (const std::pair<std::shared_ptr<MemoTable>, MemoTable::Key> &entry : memoized)
+    {
+        entry.first->insert(entry.second, res);
+    }
+
+    return res;
 }
 
 void FunctionApplication::print(std::ostream& out) const
@@ -277,6 +420,13 @@ std::shared_ptr<Node> Parser::expr(std::ostream& out)
         return std::dynamic_pointer_cast<Node>(std::make_shared<FunctionDefinition>(f, definition));
     }
 
+    // A function passed as an argument, e.g. map(f, #0)
+    if (_currentToken->type == Token::Type::COMMA || _currentToken->type == Token::Type::CLOSE_ROUND ||
+        _currentToken->type == Token::Type::CLOSE_SQUARE)
+    {
+        return std::dynamic_pointer_cast<Node>(std::make_shared<FunctionNameNode>(f));
+    }
+
     if (_currentToken->type != Token::Type::OPEN_ROUND)
     {
         std::string err = "Expected '(' but instead got: ";
@@ -2,6 +2,7 @@
 
 #include "lexer.h"
 #include "return_value.h"
+#include "symbols.h"
 
 #include <functional>
 #include <memory>
@@ -9,6 +10,10 @@
 
 
 struct FunctionScope;
+struct GlobalScope;
+struct Chunk;
+struct Memo;
+struct DefaultFunctionNode;
 
 //! Abstract syntax tree structure
 struct Node
@@ -18,7 +23,7 @@ struct Node
 	explicit Node(Token token);
 
     //! Evaluates the AST.
-    virtual std::shared_ptr<Value> eval(FunctionScope &fncScp) const = 0;
+    virtual Value eval(FunctionScope &fncScp) const = 0;
 
     //! For debugging purposes.
 	virtual void print(std::ostream& out) const;
@@ -26,15 +31,25 @@ struct Node
     //! Needed for figuring out the number of arguments in function definition.
     virtual size_t getArgc() const = 0;
 
+    //! Node which is evaluated in place of this one in the same scope, e.g. the body of an
+    //! inlined call, or nullptr. Calls in tail position continue through it.
+    virtual const Node* tailNode(const GlobalScope &) const
+    {
+        return nullptr;
+    }
+
 };
 
 //! Abstract syntax tree with int
 struct IntNode : public Node
 {
+    //! Decoded once by the parser and shared by every evaluation
+    const Value value;
+
 	explicit IntNode(Token token);
 
     //! Evaluates to Value.
-    std::shared_ptr<Value> eval(FunctionScope &fncScp) const override;
+    Value eval(FunctionScope &fncScp) const override;
 
     size_t getArgc() const override
     {
@@ -46,10 +61,30 @@ struct IntNode : public Node
 //! Abstract syntax tree with double
 struct DoubleNode : public Node
 {
+    //! Decoded once by the parser and shared by every evaluation
+    const Value value;
+
 	explicit DoubleNode(Token token);
 
     //! Evaluates to Value.
-    std::shared_ptr<Value>eval(FunctionScope &fncScp) const override;
+    Value eval(FunctionScope &fncScp) const override;
+
+    size_t getArgc() const override
+    {
+        return 0;
+    }
+};
+
+//! Abstract syntax tree with the name of a function which is not called, e.g. f in map(f, #0)
+struct FunctionNameNode : public Node
+{
+    //! Decoded once by the parser and shared by every evaluation
+    const Value value;
+
+	explicit FunctionNameNode(Token token);
+
+    //! Evaluates to Value.
+    Value eval(FunctionScope &fncScp) const override;
 
     size_t getArgc() const override
     {
@@ -65,7 +100,7 @@ struct ListLiteralNode : public Node
 	ListLiteralNode(Token token, const std::vector<std::shared_ptr<Node>> &contents);
 
     //! Evaluates to Value.
-    std::shared_ptr<Value> eval(FunctionScope &fncScp) const override;
+    Value eval(FunctionScope &fncScp) const override;
 
     //! Prints List.
 	void print(std::ostream& out) const override;
@@ -85,15 +120,18 @@ struct ListLiteralNode : public Node
 //! Abstract syntax tree with argument index
 struct ArgumentNode : public Node
 {
+    //! Decoded index of the argument
+    const size_t index;
+
 	explicit ArgumentNode(Token token);
 
     //! Evaluates to Value.
-    std::shared_ptr<Value> eval(FunctionScope &fncScp) const override;
+    Value eval(FunctionScope &fncScp) const override;
 
     //! Argc of arg is index + 1
     size_t getArgc() const override
     {
-        return std::stoi(token.data) + 1;
+        return index + 1;
     }
 };
 
@@ -101,12 +139,17 @@ struct ArgumentNode : public Node
 struct FunctionDefinition : public Node
 {
     const std::shared_ptr<Node> definition;
+    //! The pre-defined function or nullptr if the function is defined by the user
+    const DefaultFunctionNode* const builtin;
+    //! Compiled definition, filled in by the VirtualMachine on the first call
+    mutable std::shared_ptr<const Chunk> bytecode;
+    //! Whether calls are memoized, filled in by Memo::of() on the first call
+    mutable std::shared_ptr<Memo> memo;
 
-    FunctionDefinition(Token token, const std::shared_ptr<Node> definition)
-        : Node(token), definition(definition) {}
+    FunctionDefinition(Token token, const std::shared_ptr<Node> definition);
 
     //! Evaluates to Value.
-    std::shared_ptr<Value> eval(FunctionScope &fncScp) const override;
+    Value eval(FunctionScope &fncScp) const override;
 
     //! Prints function definition.
     void print(std::ostream& out) const override;
@@ -122,13 +165,14 @@ struct FunctionDefinition : public Node
 struct FunctionApplication : public Node
 {
     const std::vector<std::shared_ptr<Node>> arguments;
+    //! Interned function name
+    const size_t symbol;
 
-    FunctionApplication(Token token, const std::vector<std::shared_ptr<Node>> &arguments)
-        : Node(token), arguments(arguments) {}
+    FunctionApplication(Token token, const std::vector<std::shared_ptr<Node>> &arguments);
 	~FunctionApplication() = default;
 
     //! Evaluates to Value.
-    std::shared_ptr<Value> eval(FunctionScope &parentScp) const override;
+    Value eval(FunctionScope &parentScp) const override;
 
     //! Prints function application.
     void print(std::ostream& out) const override;
@@ -143,22 +187,37 @@ struct FunctionApplication : public Node
         }
         return res;
     }
+
+    //! Returns the called definition. Throws if the function is not defined.
+    const FunctionDefinition& resolve(const GlobalScope &globalScope) const;
+
+private:
+    // Definition resolved by the last call, valid while the GlobalScope epoch is unchanged
+    mutable const FunctionDefinition* target;
+    mutable size_t targetEpoch;
+    // For every argument which is just #idx holds idx, otherwise npos
+    std::vector<size_t> forwardedArguments;
+
+    //! Creates the scope of a call to a user defined function. Arguments which are just
+    //! #idx share the thunk of the caller, so passing them on never builds chains of thunks.
+    std::shared_ptr<FunctionScope> makeScope(GlobalScope &globalScope,
+                                             const std::shared_ptr<FunctionScope> &callerScope) const;
 };
 
 //! Abstract syntax tree with default function
 struct DefaultFunctionNode : public Node
 {
-    const std::function<std::shared_ptr<Value>(FunctionScope&)> func;
+    const std::function<Value(FunctionScope&)> func;
     const size_t argc;
 
     DefaultFunctionNode(const std::string &name,
-        const std::function<std::shared_ptr<Value>(FunctionScope&)>& func, size_t argc)
+        const std::function<Value(FunctionScope&)>& func, size_t argc)
         : Node({Token::Type::FUNC, name, -1}), func(func), argc(argc)
     {
     }
 
     //! Evaluates to Value.
-    std::shared_ptr<Value> eval(FunctionScope &fncScp) const override
+    Value eval(FunctionScope &fncScp) const override
     {
         return func(fncScp);
     }
@@ -1,41 +1,708 @@
 #include "return_value.h"
+#include "symbols.h"
 
+#include <algorithm>
 
 
-std::string ListLiteralValue::toString() const noexcept
+
+std::string Value::toString() const
 {
-    if (values.empty())
+    switch (type)
     {
-        return "[]";
+    case Type::INT_NUMBER:
+        return std::to_string(payload.intValue);
+    case Type::REAL_NUMBER:
+        return std::to_string(payload.realValue);
+    case Type::LIST_LITERAL:
+    case Type::INFINITE_LIST:
+    case Type::LIST_STREAM:
+        return payload.list->toString();
+    case Type::FUNCTION:
+        return SymbolTable::name(asFunction());
+    default:
+        return "";
+    }
+}
+
+// Hashes of values which are not lists, and the multiplier of the polynomial hash of a sequence
+static const uint64_t numberHash = 0x9e3779b97f4a7c15ULL;
+static const uint64_t infiniteListHash = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t functionHash = 0x165667b19e3779f9ULL;
+static const uint64_t hashBase = 0x100000001b3ULL;
+
+enum HashState : unsigned char
+{
+    UNKNOWN = 0,
+    REFLEXIVE,
+    NOT_REFLEXIVE,
+};
+
+//! base^exponent, wrapping around
+static uint64_t power(uint64_t base, size_t exponent) noexcept
+{
+    uint64_t res = 1;
+    for (; exponent; exponent >>= 1, base *= base)
+    {
+        if (exponent & 1)
+        {
+            res *= base;
+        }
+    }
+
+    return res;
+}
+
+//! 1 + base + ... + base^(count - 1), wrapping around. O(log count).
+static uint64_t geometricSum(uint64_t base, size_t count) noexcept
+{
+    uint64_t sum = 0;
+    uint64_t next = 1; // base^(number of terms in sum)
+
+    for (size_t bit = sizeof(size_t) * 8; bit > 0; --bit)
+    {
+        sum *= 1 + next;
+        next *= next;
+        if ((count >> (bit - 1)) & 1)
+        {
+            sum = sum * base + 1;
+            next *= base;
+        }
+    }
+
+    return sum;
+}
+
+uint64_t Value::hash() const
+{
+    switch (type)
+    {
+    case Type::INT_NUMBER:
+    case Type::REAL_NUMBER:
+        return numberHash;
+    case Type::LIST_LITERAL:
+        return asList<ListLiteralValue>().hash();
+    case Type::INFINITE_LIST:
+        return infiniteListHash;
+    case Type::LIST_STREAM:
+        return asList<StreamValue>().materialize().hash();
+    case Type::FUNCTION:
+        return functionHash ^ (asFunction() * hashBase);
+    default:
+        return 0;
+    }
+}
+
+bool Value::isReflexive() const
+{
+    switch (type)
+    {
+    case Type::REAL_NUMBER:
+        // eq() compares the difference, which is NaN for infinities
+        return std::isfinite(asReal());
+    case Type::LIST_LITERAL:
+        return asList<ListLiteralValue>().isReflexive();
+    case Type::INFINITE_LIST:
+        return std::isfinite(asList<InfiniteListValue>().first) &&
+               std::isfinite(asList<InfiniteListValue>().difference);
+    case Type::LIST_STREAM:
+        return asList<StreamValue>().materialize().isReflexive();
+    default:
+        return true;
+    }
+}
+
+uint64_t ListLiteralValue::hash() const
+{
+    // eq() finds a single element list equal to its element
+    if (count == 1)
+    {
+        return (*this)[0].hash();
     }
 
-    const size_t valuesCnt = values.size();
+    computeHash();
+
+    return (elementsHash ^ count) * hashBase;
+}
+
+bool ListLiteralValue::isReflexive() const
+{
+    computeHash();
+
+    return hashState == REFLEXIVE;
+}
+
+void ListLiteralValue::computeHash() const
+{
+    if (hashState != UNKNOWN)
+    {
+        return;
+    }
+
+    bool reflexive = true;
+    switch (kind)
+    {
+    case Kind::CONCAT:
+        leftList().computeHash();
+        rightList().computeHash();
+        elementsHash = leftList().elementsHash * power(hashBase, rightList().count) + rightList().elementsHash;
+        reflexive = leftList().hashState == REFLEXIVE && rightList().hashState == REFLEXIVE;
+        break;
+    case Kind::BOXED:
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Value &val = static_cast<const Value*>(elements)[i];
+            elementsHash = elementsHash * hashBase + val.hash();
+            reflexive = reflexive && val.isReflexive();
+        }
+        break;
+    case Kind::REALS:
+        elementsHash = numberHash * geometricSum(hashBase, count);
+        reflexive = std::all_of(static_cast<const double*>(elements), static_cast<const double*>(elements) + count,
+                                [](double val) { return std::isfinite(val); });
+        break;
+    case Kind::REAL_RANGE:
+        // The elements between two finite ones are finite
+        elementsHash = numberHash * geometricSum(hashBase, count);
+        reflexive = count == 0 || (element(0).isReflexive() && element(count - 1).isReflexive());
+        break;
+    default:
+        elementsHash = numberHash * geometricSum(hashBase, count);
+        break;
+    }
+
+    hashState = reflexive ? REFLEXIVE : NOT_REFLEXIVE;
+}
+
+bool ListLiteralValue::shares(const ListLiteralValue &fst, const ListLiteralValue &snd) noexcept
+{
+    if (&fst == &snd)
+    {
+        return true;
+    }
+    else if (fst.kind != snd.kind || fst.count != snd.count || !fst.isLeaf())
+    {
+        return false;
+    }
+    else if (fst.kind == Kind::INT_RANGE)
+    {
+        return fst.intFirst == snd.intFirst && fst.intDifference == snd.intDifference && fst.start == snd.start;
+    }
+    else if (fst.kind == Kind::REAL_RANGE)
+    {
+        return fst.first == snd.first && fst.difference == snd.difference && fst.start == snd.start;
+    }
+
+    return fst.elements == snd.elements;
+}
+
+bool ListLiteralValue::equalElements(const ListLiteralValue &fst, const ListLiteralValue &snd,
+                                     bool (*equal)(const Value&, const Value&))
+{
+    if (shares(fst, snd) && fst.isReflexive())
+    {
+        return true;
+    }
+    else if (!fst.isLeaf() && !snd.isLeaf() && fst.leftList().count == snd.leftList().count)
+    {
+        // Lists derived from the same list often share their subtrees
+        return equalElements(fst.leftList(), snd.leftList(), equal) &&
+               equalElements(fst.rightList(), snd.rightList(), equal);
+    }
+
+    Iterator sndIt = snd.begin();
+    for (const Value &val : fst)
+    {
+        if (!equal(val, *sndIt))
+        {
+            return false;
+        }
+        ++sndIt;
+    }
+
+    return true;
+}
+
+std::string ListLiteralValue::toString() const
+{
+    if (empty())
+    {
+        return "[]";
+    }
 
     std::string res = "[";
     bool first = true;
-    for (std::shared_ptr<Value> val : values)
+    for (const Value &val : *this)
     {
         if (!first)
         {
             res += " ";
         }
-        
-        res += val->toString();
+
+        res += val.toString();
         first = false;
     }
     res += ']';
-    
+
     return res;
 }
 
-std::string InfiniteListValue::toString() const noexcept
+ListLiteralValue::ListLiteralValue(std::vector<Value> &&values)
+    : ListValue(Value::Type::LIST_LITERAL), height(0), count(values.size())
+{
+    bool ints = !values.empty();
+    bool reals = !values.empty();
+    for (const Value &val : values)
+    {
+        ints = ints && val.getType() == Value::Type::INT_NUMBER;
+        reals = reals && val.getType() == Value::Type::REAL_NUMBER;
+    }
+
+    if (ints)
+    {
+        std::vector<int64_t> packed;
+        packed.reserve(values.size());
+        for (const Value &val : values)
+        {
+            packed.push_back(val.asInt());
+        }
+        store(Kind::INTS, std::move(packed));
+    }
+    else if (reals)
+    {
+        std::vector<double> packed;
+        packed.reserve(values.size());
+        for (const Value &val : values)
+        {
+            packed.push_back(val.asReal());
+        }
+        store(Kind::REALS, std::move(packed));
+    }
+    else
+    {
+        store(Kind::BOXED, std::move(values));
+    }
+}
+
+ListLiteralValue::ListLiteralValue(std::vector<int64_t> &&values)
+    : ListValue(Value::Type::LIST_LITERAL), height(0), count(values.size())
+{
+    store(Kind::INTS, std::move(values));
+}
+
+ListLiteralValue::ListLiteralValue(std::vector<double> &&values)
+    : ListValue(Value::Type::LIST_LITERAL), height(0), count(values.size())
+{
+    store(Kind::REALS, std::move(values));
+}
+
+ListLiteralValue::ListLiteralValue(double first, double difference, size_t count)
+    : ListValue(Value::Type::LIST_LITERAL), kind(Kind::REAL_RANGE), height(0),
+      count(count), elements(nullptr), first(first), difference(difference), start(0)
+{
+}
+
+ListLiteralValue::ListLiteralValue(int64_t first, int64_t difference, size_t count)
+    : ListValue(Value::Type::LIST_LITERAL), kind(Kind::INT_RANGE), height(0),
+      count(count), elements(nullptr), intFirst(first), intDifference(difference), start(0)
+{
+}
+
+ListLiteralValue::ListLiteralValue(Value &&left, Value &&right)
+    : ListValue(Value::Type::LIST_LITERAL), kind(Kind::CONCAT),
+      count(left.asList<ListLiteralValue>().count + right.asList<ListLiteralValue>().count),
+      elements(nullptr), left(std::move(left)), right(std::move(right))
+{
+    height = std::max(heightOf(this->left), heightOf(this->right)) + 1;
+}
+
+template <class T>
+void ListLiteralValue::store(Kind leafKind, std::vector<T> &&values)
+{
+    std::shared_ptr<const std::vector<T>> owned = std::make_shared<const std::vector<T>>(std::move(values));
+
+    kind = leafKind;
+    elements = owned->data();
+    storage = std::move(owned);
+}
+
+bool ListLiteralValue::unpack(std::vector<int64_t> &values) const
+{
+    values.reserve(values.size() + count);
+
+    return unpackInto(values, Kind::INTS, Value::Type::INT_NUMBER);
+}
+
+bool ListLiteralValue::unpack(std::vector<double> &values) const
+{
+    values.reserve(values.size() + count);
+
+    return unpackInto(values, Kind::REALS, Value::Type::REAL_NUMBER);
+}
+
+template <class T>
+bool ListLiteralValue::unpackInto(std::vector<T> &values, Kind packed, Value::Type type) const
+{
+    if (kind == Kind::CONCAT)
+    {
+        return leftList().unpackInto(values, packed, type) && rightList().unpackInto(values, packed, type);
+    }
+    else if (kind == packed)
+    {
+        const T *data = static_cast<const T*>(elements);
+        values.insert(values.end(), data, data + count);
+
+        return true;
+    }
+
+    // Ranges and slices of boxed leaves
+    for (size_t i = 0; i < count; ++i)
+    {
+        Value val = element(i);
+        if (val.getType() != type)
+        {
+            return false;
+        }
+        values.push_back(type == Value::Type::INT_NUMBER ? static_cast<T>(val.asInt())
+                                                        : static_cast<T>(val.asReal()));
+    }
+
+    return true;
+}
+
+Value ListLiteralValue::operator[](size_t idx) const noexcept
+{
+    return leafAt(idx).element(idx);
+}
+
+const ListLiteralValue& ListLiteralValue::leafAt(size_t &idx) const noexcept
+{
+    const ListLiteralValue *lst = this;
+    while (!lst->isLeaf())
+    {
+        const ListLiteralValue &fst = lst->leftList();
+        if (idx < fst.count)
+        {
+            lst = &fst;
+        }
+        else
+        {
+            idx -= fst.count;
+            lst = &lst->rightList();
+        }
+    }
+
+    return *lst;
+}
+
+void ListLiteralValue::Iterator::locate() noexcept
+{
+    position = idx;
+    leaf = &list->leafAt(position);
+    leafEnd = idx - position + leaf->count;
+}
+
+Value ListLiteralValue::slice(const Value &list, size_t offset, size_t length)
+{
+    const ListLiteralValue &lst = list.asList<ListLiteralValue>();
+
+    if (offset == 0 && length == lst.count)
+    {
+        return list;
+    }
+    else if (length == 0)
+    {
+        return Value::makeList<ListLiteralValue>(std::vector<Value>());
+    }
+    else if (lst.kind == Kind::INT_RANGE || lst.kind == Kind::REAL_RANGE)
+    {
+        ListLiteralValue *range = lst.kind == Kind::INT_RANGE ?
+            new ListLiteralValue(lst.intFirst, lst.intDifference, length) :
+            new ListLiteralValue(lst.first, lst.difference, length);
+        range->start = lst.start + offset;
+
+        return Value::makeList(range);
+    }
+    else if (lst.isLeaf())
+    {
+        const size_t elementSize = lst.kind == Kind::INTS ? sizeof(int64_t)
+                                 : lst.kind == Kind::REALS ? sizeof(double) : sizeof(Value);
+        const void *first = static_cast<const char*>(lst.elements) + offset * elementSize;
+
+        return Value::makeList(new ListLiteralValue(lst.kind, lst.storage, first, length));
+    }
+
+    const size_t leftCount = lst.leftList().count;
+    if (offset + length <= leftCount)
+    {
+        return slice(lst.left, offset, length);
+    }
+    else if (offset >= leftCount)
+    {
+        return slice(lst.right, offset - leftCount, length);
+    }
+
+    return join(slice(lst.left, offset, leftCount - offset), slice(lst.right, 0, offset + length - leftCount));
+}
+
+Value ListLiteralValue::concat(const Value &fst, const Value &snd)
+{
+    return join(fst, snd);
+}
+
+Value ListLiteralValue::join(const Value &fst, const Value &snd)
+{
+    const ListLiteralValue &l = fst.asList<ListLiteralValue>();
+    const ListLiteralValue &r = snd.asList<ListLiteralValue>();
+
+    if (l.empty())
+    {
+        return snd;
+    }
+    else if (r.empty())
+    {
+        return fst;
+    }
+    else if (l.height > r.height + 1)
+    {
+        return rebalance(l.left, join(l.right, snd));
+    }
+    else if (r.height > l.height + 1)
+    {
+        return rebalance(join(fst, r.left), r.right);
+    }
+    else if (l.count + r.count <= maxMergedLeaf)
+    {
+        // Small lists are copied to a single leaf, so building a list one element at a
+        // time does not create a node for every element. The leaf stays packed if both are.
+        std::vector<Value> values;
+        values.reserve(l.count + r.count);
+        for (const Value &val : l)
+        {
+            values.push_back(val);
+        }
+        for (const Value &val : r)
+        {
+            values.push_back(val);
+        }
+
+        return Value::makeList<ListLiteralValue>(std::move(values));
+    }
+
+    return node(fst, snd);
+}
+
+Value ListLiteralValue::rebalance(const Value &fst, const Value &snd)
+{
+    if (heightOf(fst) > heightOf(snd) + 1)
+    {
+        const ListLiteralValue &l = fst.asList<ListLiteralValue>();
+        if (heightOf(l.left) >= heightOf(l.right))
+        {
+            return node(l.left, node(l.right, snd));
+        }
+
+        const ListLiteralValue &lr = l.rightList();
+        return node(node(l.left, lr.left), node(lr.right, snd));
+    }
+    else if (heightOf(snd) > heightOf(fst) + 1)
+    {
+        const ListLiteralValue &r = snd.asList<ListLiteralValue>();
+        if (heightOf(r.right) >= heightOf(r.left))
+        {
+            return node(node(fst, r.left), r.right);
+        }
+
+        const ListLiteralValue &rl = r.leftList();
+        return node(node(fst, rl.left), node(rl.right, r.right));
+    }
+
+    return node(fst, snd);
+}
+
+Value ListLiteralValue::node(const Value &fst, const Value &snd)
+{
+    return Value::makeList(new ListLiteralValue(Value(fst), Value(snd)));
+}
+
+std::string InfiniteListValue::toString() const
 {
     std::string res = "[";
     for (size_t i = 0; i < 8; ++i)
     {
-        res += nth(i)->toString();
+        res += nth(i).toString();
     }
     res += "...";
 
     return res;
-}
\ No newline at end of file
+}
+StreamValue::Suspension::~Suspension()
+{
+    // A long stream is a chain of suspensions. Releasing it recursively could overflow
+    // the stack, so the outermost destructor releases the chain one stream at a time.
+    static thread_local std::vector<Value> released;
+    static thread_local bool releasing = false;
+
+    released.push_back(std::move(value));
+
+    if (releasing)
+    {
+        return;
+    }
+
+    releasing = true;
+    while (!released.empty())
+    {
+        Value next = std::move(released.back());
+        released.pop_back();
+    }
+    releasing = false;
+}
+
+const Value& StreamValue::Suspension::force()
+{
+    if (!value)
+    {
+        value = compute();
+
+        // The computation and everything it refers to is not needed anymore
+        compute = nullptr;
+    }
+
+    return value;
+}
+
+Value StreamValue::tail() const
+{
+    const ListLiteralValue &lst = prefix.asList<ListLiteralValue>();
+
+    if (lst.size() > 1)
+    {
+        return Value::makeList<StreamValue>(ListLiteralValue::slice(prefix, 1, lst.size() - 1), rest);
+    }
+
+    return rest->force();
+}
+
+Value StreamValue::take(size_t count) const
+{
+    Value taken = Value::makeList<ListLiteralValue>(std::vector<Value>());
+    const StreamValue *stream = this;
+    Value next; // Owns stream after the first part
+
+    while (!stream->cache)
+    {
+        const size_t size = stream->prefix.asList<ListLiteralValue>().size();
+        if (count <= size)
+        {
+            return ListLiteralValue::concat(taken, ListLiteralValue::slice(stream->prefix, 0, count));
+        }
+
+        taken = ListLiteralValue::concat(taken, stream->prefix);
+        count -= size;
+
+        Value forced = stream->rest->force();
+        next = forced;
+        if (next.getType() != Value::Type::LIST_STREAM)
+        {
+            const size_t rest = next.asList<ListLiteralValue>().size();
+
+            return ListLiteralValue::concat(taken, ListLiteralValue::slice(next, 0, std::min(count, rest)));
+        }
+        stream = &next.asList<StreamValue>();
+    }
+
+    Value all = stream->materialize();
+    const size_t size = all.asList<ListLiteralValue>().size();
+
+    return ListLiteralValue::concat(taken, ListLiteralValue::slice(all, 0, std::min(count, size)));
+}
+
+Value StreamValue::drop(size_t count) const
+{
+    const StreamValue *stream = this;
+    Value next;
+
+    while (!stream->cache)
+    {
+        const size_t size = stream->prefix.asList<ListLiteralValue>().size();
+        if (count < size)
+        {
+            return Value::makeList<StreamValue>(
+                ListLiteralValue::slice(stream->prefix, count, size - count), stream->rest);
+        }
+
+        count -= size;
+
+        Value forced = stream->rest->force();
+        next = forced;
+        if (count == 0)
+        {
+            return next;
+        }
+        else if (next.getType() != Value::Type::LIST_STREAM)
+        {
+            const size_t rest = next.asList<ListLiteralValue>().size();
+
+            return ListLiteralValue::slice(next, std::min(count, rest), rest - std::min(count, rest));
+        }
+        stream = &next.asList<StreamValue>();
+    }
+
+    Value all = stream->materialize();
+    const size_t size = all.asList<ListLiteralValue>().size();
+
+    return ListLiteralValue::slice(all, std::min(count, size), size - std::min(count, size));
+}
+
+Value StreamValue::materialize() const
+{
+    if (!cache)
+    {
+        std::vector<Value> elements;
+        std::vector<std::pair<const StreamValue*, size_t>> visited;
+        const StreamValue *stream = this;
+        Value end;
+
+        // Collects the prefixes until the stream ends or reaches an already computed part
+        while (!end)
+        {
+            visited.push_back(std::make_pair(stream, elements.size()));
+            for (const Value &val : stream->prefix.asList<ListLiteralValue>())
+            {
+                elements.push_back(val);
+            }
+
+            const Value &next = stream->rest->force();
+            if (next.getType() != Value::Type::LIST_STREAM)
+            {
+                end = next;
+            }
+            else if (next.asList<StreamValue>().cache)
+            {
+                end = next.asList<StreamValue>().materialize();
+            }
+            else
+            {
+                stream = &next.asList<StreamValue>();
+            }
+        }
+
+        Value all = ListLiteralValue::concat(Value::makeList<ListLiteralValue>(std::move(elements)), end);
+
+        // Every visited part of the stream shares the result, so materializing its tails is O(log n)
+        for (const std::pair<const StreamValue*, size_t> &part : visited)
+        {
+            part.first->cache = all;
+            part.first->cacheOffset = part.second;
+        }
+    }
+
+    const size_t size = cache.asList<ListLiteralValue>().size();
+
+    return ListLiteralValue::slice(cache, cacheOffset, size - cacheOffset);
+}
+
+std::string StreamValue::toString() const
+{
+    return materialize().toString();
+}
@@ -3,109 +3,481 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <stdexcept>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <cstddef>
 
-//! Abstract class for return values
+struct ListValue;
+
+//! Return value stored in 16 bytes. Numbers are kept inline and only lists are allocated
+//! on the heap, where they are shared through an intrusive reference count.
 struct Value
 {
-    enum class Type
+    enum class Type : unsigned char
     {
         REAL_NUMBER,
         INT_NUMBER,
         LIST_LITERAL,
         INFINITE_LIST,
+        LIST_STREAM,
+        FUNCTION,    // Name of a function, passed to higher-order functions like map()
 
+        NONE, // Empty value, e.g. an argument which is not evaluated yet
     };
 
-    Type type;
+    //! Creates an empty value
+    Value() noexcept : type(Type::NONE) { payload.intValue = 0; }
 
-    Value(Type type) noexcept : type(type) {}
+    //! Creates an int value
+    static Value makeInt(int64_t value) noexcept
+    {
+        Value res(Type::INT_NUMBER);
+        res.payload.intValue = value;
+        return res;
+    }
 
-    //! Gets the string representation of the data inside.
-    virtual std::string toString() const noexcept = 0;
+    //! Creates a real value
+    static Value makeReal(double value) noexcept
+    {
+        Value res(Type::REAL_NUMBER);
+        res.payload.realValue = value;
+        return res;
+    }
 
-};
+    //! Creates a reference to the function with the interned name symbol
+    static Value makeFunction(size_t symbol) noexcept
+    {
+        Value res(Type::FUNCTION);
+        res.payload.intValue = symbol;
+        return res;
+    }
 
-//! Contains double
-struct RealValue : public Value
-{
-    const double value;
+    //! Creates a list value which shares ownership of the list
+    static Value makeList(const ListValue* list) noexcept;
 
-    RealValue(double value) noexcept : Value(Type::REAL_NUMBER), value(value) {}
+    //! Allocates a list of type T and wraps it in a value
+    template <class T, class... Args>
+    static Value makeList(Args&&... args)
+    {
+        return makeList(new T(std::forward<Args>(args)...));
+    }
 
-    //! Overriden method of class Value. Converts double to string.
-    std::string toString() const noexcept override
+    Value(const Value& other) noexcept : type(other.type), payload(other.payload)
     {
-        return std::to_string(value);
+        retain();
     }
 
-};
+    Value(Value&& other) noexcept : type(other.type), payload(other.payload)
+    {
+        other.type = Type::NONE;
+    }
 
-//! Contains int
-struct IntValue : public Value
-{
-    const int value;
+    Value& operator=(Value other) noexcept
+    {
+        std::swap(type, other.type);
+        std::swap(payload, other.payload);
+        return *this;
+    }
+
+    ~Value()
+    {
+        release();
+    }
 
-    IntValue(int value) noexcept : Value(Type::INT_NUMBER), value(value) {}
+    Type getType() const noexcept { return type; }
 
-    //! Overriden method of class Value. Converts int to string.
-    std::string toString() const noexcept override
+    //! False for empty values
+    explicit operator bool() const noexcept { return type != Type::NONE; }
+
+    bool isNumber() const noexcept { return type == Type::INT_NUMBER || type == Type::REAL_NUMBER; }
+    bool isList() const noexcept
+    {
+        return type == Type::LIST_LITERAL || type == Type::INFINITE_LIST || type == Type::LIST_STREAM;
+    }
+
+    //! Unchecked accessor, the value must be INT_NUMBER
+    int64_t asInt() const noexcept { return payload.intValue; }
+    //! Unchecked accessor, the value must be REAL_NUMBER
+    double asReal() const noexcept { return payload.realValue; }
+    //! Unchecked accessor, the value must be FUNCTION. Returns the interned name.
+    size_t asFunction() const noexcept { return payload.intValue; }
+    //! Unchecked accessor, the value must be a number
+    double asNumber() const noexcept
     {
-        return std::to_string(value);
+        return type == Type::INT_NUMBER ? payload.intValue : payload.realValue;
     }
+    //! Unchecked accessor, the value must be a list of type T
+    template <class T>
+    const T& asList() const noexcept { return *static_cast<const T*>(payload.list); }
+
+    //! Identity of the list, nullptr for numbers
+    const ListValue* listIdentity() const noexcept { return isList() ? payload.list : nullptr; }
+
+    //! Gets the string representation of the data inside. Computes the whole list of a stream.
+    std::string toString() const;
+
+    //! Hash consistent with eq(), values it finds equal have equal hashes. Numbers are equal
+    //! within an epsilon, so they all hash the same and lists hash their shape.
+    uint64_t hash() const;
+    //! False if the value is not equal to itself, i.e. it holds a NaN or infinity
+    bool isReflexive() const;
+
+private:
+    Type type;
+    union Payload
+    {
+        int64_t intValue;
+        double realValue;
+        const ListValue* list;
+    } payload;
+
+    explicit Value(Type type) noexcept : type(type) {}
+
+    void retain() const noexcept;
+    void release() noexcept;
 
 };
 
+static_assert(sizeof(Value) == 16, "Value should stay a 16 byte tagged union");
+
 //! Class for lists
-struct ListValue : public Value
+struct ListValue
 {
-    ListValue(Value::Type type) : Value(type)
+    const Value::Type type;
+
+    ListValue(Value::Type type) : type(type), references(0)
     {
-        if (type != Value::Type::LIST_LITERAL && type != Value::Type::INFINITE_LIST)
+        if (type != Value::Type::LIST_LITERAL && type != Value::Type::INFINITE_LIST &&
+            type != Value::Type::LIST_STREAM)
         {
             throw std::runtime_error("A list can be either finite or infinite!");
         }
     }
+    ListValue(const ListValue& other) = delete;
+    ListValue& operator=(const ListValue& other) = delete;
+    virtual ~ListValue() = default;
 
     //! Gets the string representation of the list.
-    virtual std::string toString() const noexcept = 0;
+    virtual std::string toString() const = 0;
+
+private:
+    friend struct Value;
+
+    mutable std::atomic<size_t> references;
 
 };
 
-//! Contains finite list
+//! Contains finite list. Lists are persistent balanced trees: a list is either a leaf,
+//! which holds a slice of shared storage, or the concatenation of two lists. Slices and
+//! concatenations share the elements of their operands instead of copying them.
+//! Leaves of only ints or only reals store them packed, 8 bytes per element, and
+//! arithmetic progressions are computed on access instead of being stored.
 struct ListLiteralValue : public ListValue
 {
-    // Turns out vector is faster than forward_list for heavy list operations
-    std::vector<std::shared_ptr<Value>> values;
+    //! Packs the values if all of them are ints or all of them are reals
+    ListLiteralValue(const std::vector<Value> &values) : ListLiteralValue(std::vector<Value>(values)) {}
+    ListLiteralValue(std::vector<Value> &&values);
+    explicit ListLiteralValue(std::vector<int64_t> &&values);
+    explicit ListLiteralValue(std::vector<double> &&values);
+    //! Creates the range first, first + difference, ... with count reals
+    ListLiteralValue(double first, double difference, size_t count);
+    //! Creates the range first, first + difference, ... with count ints, which wrap around on overflow
+    ListLiteralValue(int64_t first, int64_t difference, size_t count);
+
+    size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    //! Unchecked accessor to the n-th element. O(log n).
+    Value operator[](size_t idx) const noexcept;
+
+    //! Returns the elements [offset, offset + length) of list. O(log n).
+    static Value slice(const Value &list, size_t offset, size_t length);
+
+    //! Returns the concatenation of two lists. O(log n).
+    static Value concat(const Value &fst, const Value &snd);
+
+    //! See Value::hash(). Computed once per node, concatenations combine their operands.
+    uint64_t hash() const;
+    bool isReflexive() const;
+
+    //! Compares the elements of two lists of the same size with equal. Parts which the lists
+    //! share are equal without comparing them.
+    static bool equalElements(const ListLiteralValue &fst, const ListLiteralValue &snd,
+                              bool (*equal)(const Value&, const Value&));
 
-    ListLiteralValue(const std::vector<std::shared_ptr<Value>> &values) noexcept
-        : ListValue(Type::LIST_LITERAL), values(values)
+    //! True if the elements are computed as rangeFirst() + idx * rangeStep()
+    bool isRange() const noexcept { return kind == Kind::INT_RANGE || kind == Kind::REAL_RANGE; }
+    double rangeFirst() const noexcept
     {
+        return kind == Kind::INT_RANGE ? intRangeFirst() : first + difference * start;
     }
+    double rangeStep() const noexcept { return kind == Kind::INT_RANGE ? intDifference : difference; }
+    //! rangeFirst() and rangeStep() of a range of ints, exact beyond 2^53
+    int64_t intRangeFirst() const noexcept { return intElement(0); }
+    int64_t intRangeStep() const noexcept { return intDifference; }
+
+    //! Appends the elements to values if all of them are ints, packed leaves are copied in
+    //! bulk. Returns false otherwise, values then holds an unspecified part of them.
+    bool unpack(std::vector<int64_t> &values) const;
+    //! Appends the elements to values if all of them are reals
+    bool unpack(std::vector<double> &values) const;
+
+    //! Forward iterator over the elements of a list
+    class Iterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef Value value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Value* pointer;
+        typedef Value reference;
+
+        Iterator(const ListLiteralValue &list, size_t idx) noexcept
+            : list(&list), idx(idx), leaf(nullptr), position(0), leafEnd(idx)
+        {
+            if (idx < list.size())
+            {
+                locate();
+            }
+        }
+
+        Value operator*() const noexcept { return leaf->element(position); }
+
+        Iterator& operator++() noexcept
+        {
+            if (++idx < leafEnd)
+            {
+                ++position;
+            }
+            else if (idx < list->size())
+            {
+                locate();
+            }
+
+            return *this;
+        }
+
+        bool operator==(const Iterator &other) const noexcept { return idx == other.idx; }
+        bool operator!=(const Iterator &other) const noexcept { return idx != other.idx; }
+
+    private:
+        const ListLiteralValue *list;
+        size_t idx;
+        const ListLiteralValue *leaf;
+        size_t position;    // Index of the element inside the leaf
+        size_t leafEnd;     // End of the current leaf as an index of list
+
+        //! Finds the leaf of the element idx
+        void locate() noexcept;
+
+    };
+
+    Iterator begin() const noexcept { return Iterator(*this, 0); }
+    Iterator end() const noexcept { return Iterator(*this, count); }
 
     //! Gets the string representation of the data inside.
-    std::string toString() const noexcept override;
-    
+    std::string toString() const override;
+
+private:
+    //! Layout of a node
+    enum class Kind : unsigned char
+    {
+        BOXED,  // Leaf of arbitrary values
+        INTS,   // Leaf of packed int64_t
+        REALS,  // Leaf of packed doubles
+        INT_RANGE,  // Leaf of a range of ints
+        REAL_RANGE, // Leaf of a range of reals
+        CONCAT, // Concatenation of left and right
+    };
+
+    // Leaves shorter than this are merged when they are concatenated
+    static const size_t maxMergedLeaf = 32;
+
+    Kind kind;
+    unsigned char height; // 0 for leaves
+    // Whether elementsHash is computed and the elements are reflexive
+    mutable unsigned char hashState = 0;
+    size_t count;
+    // std::vector of Value, int64_t or double depending on the kind. Turns out vector
+    // is faster than forward_list for heavy list operations.
+    std::shared_ptr<const void> storage;
+    const void *elements; // First element of the leaf inside storage
+    // The elements of a range are first + difference * (start + idx), int64_t for INT_RANGE
+    union
+    {
+        double first;
+        int64_t intFirst;
+    };
+    union
+    {
+        double difference;
+        int64_t intDifference;
+    };
+    size_t start;
+    // Operands of a concatenation, empty for leaves
+    Value left;
+    Value right;
+    // Polynomial hash of the hashes of the elements
+    mutable uint64_t elementsHash = 0;
+
+    ListLiteralValue(Kind kind, const std::shared_ptr<const void> &storage, const void *elements, size_t count)
+        : ListValue(Value::Type::LIST_LITERAL), kind(kind), height(0), count(count),
+          storage(storage), elements(elements)
+    {
+    }
+    ListLiteralValue(Value &&left, Value &&right);
+
+    //! Makes the leaf own values
+    template <class T>
+    void store(Kind leafKind, std::vector<T> &&values);
+    //! unpack() of the elements of type, which leaves of kind packed store as T
+    template <class T>
+    bool unpackInto(std::vector<T> &values, Kind packed, Value::Type type) const;
+
+    bool isLeaf() const noexcept { return kind != Kind::CONCAT; }
+    //! Computes elementsHash and the reflexivity once
+    void computeHash() const;
+    //! True if both lists are the same node or views of the same stored elements
+    static bool shares(const ListLiteralValue &fst, const ListLiteralValue &snd) noexcept;
+    const ListLiteralValue& leftList() const noexcept { return left.asList<ListLiteralValue>(); }
+    const ListLiteralValue& rightList() const noexcept { return right.asList<ListLiteralValue>(); }
+
+    //! Unchecked accessor to the n-th element of a leaf
+    Value element(size_t idx) const noexcept
+    {
+        switch (kind)
+        {
+        case Kind::INTS:
+            return Value::makeInt(static_cast<const int64_t*>(elements)[idx]);
+        case Kind::REALS:
+            return Value::makeReal(static_cast<const double*>(elements)[idx]);
+        case Kind::INT_RANGE:
+            return Value::makeInt(intElement(idx));
+        case Kind::REAL_RANGE:
+            return Value::makeReal(first + difference * (start + idx));
+        default:
+            return static_cast<const Value*>(elements)[idx];
+        }
+    }
+
+    //! Element of an INT_RANGE leaf, computed with wraparound
+    int64_t intElement(size_t idx) const noexcept
+    {
+        return static_cast<int64_t>(uint64_t(intFirst) + uint64_t(intDifference) * (start + idx));
+    }
+
+    //! Finds the leaf of the element idx, idx becomes the index inside the leaf
+    const ListLiteralValue& leafAt(size_t &idx) const noexcept;
+
+    //! Concatenates two balanced trees
+    static Value join(const Value &fst, const Value &snd);
+    //! Concatenates two balanced trees whose heights differ by at most 2
+    static Value rebalance(const Value &fst, const Value &snd);
+    static Value node(const Value &fst, const Value &snd);
+    static size_t heightOf(const Value &list) noexcept { return list.asList<ListLiteralValue>().height; }
+
 };
 
 //! Contains infinite list
 struct InfiniteListValue : public ListValue
 {
-    double first;
-    double difference;
+    const double first;
+    const double difference;
 
-    InfiniteListValue(double first, double difference) noexcept
-        : ListValue(Type::INFINITE_LIST), first(first), difference(difference)
+    InfiniteListValue(double first, double difference)
+        : ListValue(Value::Type::INFINITE_LIST), first(first), difference(difference)
     {
         ;
     }
 
     //! Gets the string representation of the data inside.
-    std::string toString() const noexcept override;
+    std::string toString() const override;
 
     //! Accessor to the n-th element
-    std::shared_ptr<Value> nth(size_t idx) const
+    Value nth(size_t idx) const noexcept
+    {
+        return Value::makeReal(first + idx * difference);
+    }
+
+};
+
+//! Finite list whose elements after a known prefix are computed on first use. The rest
+//! may be another stream, so a list built by recursion is computed only as far as it is used.
+struct StreamValue : public ListValue
+{
+    //! Computes the rest of a stream at most once. Shared by every stream which ends with it.
+    struct Suspension
+    {
+        explicit Suspension(std::function<Value()> &&compute) : compute(std::move(compute)) {}
+        Suspension(const Suspension& other) = delete;
+        Suspension& operator=(const Suspension& other) = delete;
+        ~Suspension();
+
+        //! Returns the rest, which is a list literal or another stream
+        const Value& force();
+
+    private:
+        std::function<Value()> compute;
+        Value value;
+
+    };
+
+    //! Non-empty list literal the stream starts with
+    const Value prefix;
+    const std::shared_ptr<Suspension> rest;
+
+    StreamValue(const Value &prefix, const std::shared_ptr<Suspension> &rest)
+        : ListValue(Value::Type::LIST_STREAM), prefix(prefix), rest(rest), cacheOffset(0)
     {
-        return std::shared_ptr<Value>(new RealValue(first + idx * difference));
     }
 
-};
\ No newline at end of file
+    Value head() const { return prefix.asList<ListLiteralValue>()[0]; }
+    //! Computes the next part of the stream if the prefix has a single element
+    Value tail() const;
+
+    //! Returns the first count elements as a list literal, computing only the parts they are in
+    Value take(size_t count) const;
+    //! Returns the stream without its first count elements, computing only the parts they are in
+    Value drop(size_t count) const;
+
+    //! Returns all elements as a list literal. The whole stream is computed once, in O(n).
+    Value materialize() const;
+
+    //! Gets the string representation of the data inside.
+    std::string toString() const override;
+
+private:
+    // Set by materialize(): the elements of this stream start at cacheOffset of cache
+    mutable Value cache;
+    mutable size_t cacheOffset;
+
+};
+
+inline Value Value::makeList(const ListValue* list) noexcept
+{
+    Value res(list->type);
+    res.payload.list = list;
+    res.retain();
+    return res;
+}
+
+inline void Value::retain() const noexcept
+{
+    if (isList())
+    {
+        payload.list->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+inline void Value::release() noexcept
+{
+    if (isList() && payload.list->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete payload.list;
+    }
+}
@@ -0,0 +1,24 @@
+#include "symbols.h"
+
+
+size_t SymbolTable::intern(const std::string& name)
+{
+    SymbolTable& table = getInstance();
+
+    std::unordered_map<std::string, size_t>::const_iterator it = table.ids.find(name);
+    if (it != table.ids.end())
+    {
+        return it->second;
+    }
+
+    size_t id = table.names.size();
+    table.names.push_back(name);
+    table.ids.emplace(name, id);
+
+    return id;
+}
+
+const std::string& SymbolTable::name(size_t id)
+{
+    return getInstance().names.at(id);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//! Interns function names to dense integer ids, so lookups don't hash strings at runtime
+class SymbolTable
+{
+public:
+    SymbolTable(const SymbolTable& other) = delete;
+    SymbolTable& operator=(const SymbolTable& other) = delete;
+
+    //! Returns the id of the name, assigning a new one on first use
+    static size_t intern(const std::string& name);
+
+    //! Returns the name of an interned id
+    static const std::string& name(size_t id);
+
+private:
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<std::string> names;
+
+    SymbolTable() = default;
+
+    //! Returns static instance of the table
+    static SymbolTable& getInstance()
+    {
+        static SymbolTable object;
+
+        return object;
+    }
+
+};
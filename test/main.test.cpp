@@ -1,30 +1,42 @@
 #include "../lexer.h"
 #include "../parser.h"
 #include "../interpreter.h"
+#include "../memo.h"
+#include "../optimizer.h"
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <sstream>
 
-TEST_CASE("Default functions")
+
+//! Parses and evaluates a single line
+Value evaluateLine(GlobalScope &globalScope, const std::string &line)
+{
+    Lexer l(line);
+    std::vector<Token> tokens = l.lex();
+    Parser p(tokens.begin());
+    std::shared_ptr<FunctionScope> localScope = std::make_shared<FunctionScope>(
+        globalScope, nullptr, std::vector<std::shared_ptr<Node>>());
+
+    return globalScope.evaluate(p.parse(std::cout), *localScope);
+}
+
+//! Runs commands.txt with the given engine and compares the output with results.txt
+void checkCommands(GlobalScope::Engine engine)
 {
     GlobalScope globalScope;
     globalScope.loadDefaultLibrary();
+    globalScope.setEngine(engine);
     std::ifstream commands("commands.txt");
     std::ifstream results("results.txt");
     std::string line, res;
-    
+
     if (commands.is_open() && results.is_open())
     {
         while (std::getline(commands, line) && std::getline(results, res))
         {
-            Lexer l(line);
-            std::vector<Token> tokens = l.lex();
-            Parser p(tokens.begin());
-            FunctionScope localScope(globalScope, nullptr, std::vector<std::shared_ptr<Node>>());
-            std::shared_ptr<Value> val = p.parse(std::cout)->eval(localScope);
-
-            REQUIRE(val->toString() == res);
+            REQUIRE(evaluateLine(globalScope, line).toString() == res);
         }
 
         commands.close();
@@ -34,4 +46,286 @@ TEST_CASE("Default functions")
     {
         REQUIRE(false);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Default functions")
+{
+    checkCommands(GlobalScope::Engine::TREE_WALKER);
+}
+
+TEST_CASE("Bytecode engine")
+{
+    checkCommands(GlobalScope::Engine::BYTECODE);
+}
+
+TEST_CASE("Deep recursion on the bytecode engine")
+{
+    GlobalScope globalScope;
+    globalScope.loadDefaultLibrary();
+    globalScope.setEngine(GlobalScope::Engine::BYTECODE);
+
+    evaluateLine(globalScope, "deep -> if(eq(#0, 0), 0, add(1, deep(sub(#0, 1))))");
+    REQUIRE(evaluateLine(globalScope, "deep(300000)").toString() == "300000");
+
+    globalScope.setMaxDepth(1000);
+    REQUIRE(evaluateLine(globalScope, "deep(1000)").toString() == "1000");
+    REQUIRE_THROWS_AS(evaluateLine(globalScope, "deep(1001)"), std::runtime_error);
+    REQUIRE(evaluateLine(globalScope, "deep(10)").toString() == "10");
+}
+
+TEST_CASE("Tail recursion with accumulators runs in constant stack")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        evaluateLine(globalScope, "cnt -> if(eq(#0, 0), #1, cnt(sub(#0, 1), add(#1, 1)))");
+        REQUIRE(evaluateLine(globalScope, "cnt(1000000, 0)").toString() == "1000000");
+        evaluateLine(globalScope, "sumTo -> if(le(#0, 0), #1, sumTo(sub(#0, 1), add(#1, #0)))");
+        REQUIRE(evaluateLine(globalScope, "sumTo(1000000, 0)").toString() == "500000500000");
+    }
+}
+
+TEST_CASE("Deeply nested arguments on the bytecode engine")
+{
+    GlobalScope globalScope;
+    globalScope.loadDefaultLibrary();
+    globalScope.setEngine(GlobalScope::Engine::BYTECODE);
+
+    // The accumulator is not forced on every path, so it grows into a chain of arguments
+    evaluateLine(globalScope, "lazy -> if(eq(#0, 0), #1, if(eq(#0, -7), 5, lazy(sub(#0, 1), add(#1, 1))))");
+    REQUIRE(evaluateLine(globalScope, "lazy(100, 0)").toString() == "100");
+    REQUIRE_THROWS_AS(evaluateLine(globalScope, "lazy(19000, 0)"), std::runtime_error);
+    REQUIRE_THROWS_AS(evaluateLine(globalScope, "lazy(1000000, 0)"), std::runtime_error);
+}
+
+TEST_CASE("Sort accepts only numbers of one type")
+{
+    GlobalScope globalScope;
+    globalScope.loadDefaultLibrary();
+
+    REQUIRE(evaluateLine(globalScope, "sort([2])").toString() == "[2]");
+    REQUIRE_THROWS_AS(evaluateLine(globalScope, "sort([[2 1]])"), std::runtime_error);
+    REQUIRE_THROWS_AS(evaluateLine(globalScope, "sort([3 1.5 2])"), std::runtime_error);
+}
+
+TEST_CASE("Folded constants follow redefined builtins")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        evaluateLine(globalScope, "k -> add(1, sqrt(4))");
+        REQUIRE(evaluateLine(globalScope, "k()").toString() == "3.000000");
+        evaluateLine(globalScope, "add -> mul(#0, #1)");
+        REQUIRE(evaluateLine(globalScope, "k()").toString() == "2.000000");
+    }
+}
+
+TEST_CASE("Branches which are not taken are not folded")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        // Sorting the range would need more memory than there is
+        evaluateLine(globalScope, "j -> if(1, 0, length(sort(list(5, -1, #0))))");
+        REQUIRE(evaluateLine(globalScope, "j(3000000000)").toString() == "0");
+        evaluateLine(globalScope, "z -> if(#0, 0, length(sort(list(5, -1, #1))))");
+        REQUIRE(evaluateLine(globalScope, "z(1, 3000000000)").toString() == "0");
+        evaluateLine(globalScope, "n -> nand(0, length(sort(list(5, -1, #0))))");
+        REQUIRE(evaluateLine(globalScope, "n(3000000000)").toString() == "1");
+    }
+}
+
+TEST_CASE("Only pure recursive calls are concatenated lazily")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        evaluateLine(globalScope, "naturals -> concat([#0], naturals(add(#0, 1)))");
+        REQUIRE(evaluateLine(globalScope, "head(tail(naturals(3)))").toString() == "4");
+
+        evaluateLine(globalScope, "five -> 5");
+        REQUIRE_THROWS_AS(evaluateLine(globalScope, "if(concat([1], five()), 11, 22)"), std::runtime_error);
+        evaluateLine(globalScope, "oops -> div(1, 0)");
+        REQUIRE_THROWS_AS(evaluateLine(globalScope, "if(concat([1], oops()), 11, 22)"), std::runtime_error);
+
+        std::ostringstream output;
+        std::streambuf *cout = std::cout.rdbuf(output.rdbuf());
+        evaluateLine(globalScope, "echo -> concat([write(7)], [])");
+        evaluateLine(globalScope, "if(concat([1], echo()), 11, 22)");
+        std::cout.rdbuf(cout);
+        REQUIRE(output.str().find("7") != std::string::npos);
+    }
+}
+
+TEST_CASE("Fused pipelines behave like the unfused calls")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        // Every map() runs before the filter() which uses its list
+        evaluateLine(globalScope, "w2 -> if(write(#0), 0, #0)");
+        evaluateLine(globalScope, "w1 -> write(add(#0, 100))");
+        std::ostringstream output;
+        std::streambuf *cout = std::cout.rdbuf(output.rdbuf());
+        evaluateLine(globalScope, "length(filter(w1, map(w2, [1 2 3])))");
+        std::cout.rdbuf(cout);
+        REQUIRE(output.str() == "1\n2\n3\n101\n102\n103\n");
+
+        // Adds in the same order as sum()
+        evaluateLine(globalScope, "id -> #0");
+        evaluateLine(globalScope,
+            "big -> if(eq(mod(#0, 4), 0), 10000000000000000.0, if(eq(mod(#0, 4), 2), -10000000000000000.0, 1.0))");
+        evaluateLine(globalScope, "L -> map(big, list(0, 1, 64))");
+        REQUIRE(evaluateLine(globalScope, "eq(sum(map(id, L())), sum(L()))").toString() == "1");
+    }
+}
+
+TEST_CASE("Inlined functions follow redefinitions")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        evaluateLine(globalScope, "sq -> mul(#0, #0)");
+        evaluateLine(globalScope, "sumsq -> add(sq(#0), sq(#1))");
+        REQUIRE(evaluateLine(globalScope, "sumsq(3, 4)").toString() == "25");
+        evaluateLine(globalScope, "sq -> add(#0, #0)");
+        REQUIRE(evaluateLine(globalScope, "sumsq(3, 4)").toString() == "14");
+
+        // An argument used twice is still evaluated once
+        evaluateLine(globalScope, "dup -> add(#0, #0)");
+        evaluateLine(globalScope, "once -> dup(sub(read(), 1))");
+        std::istringstream input("5");
+        std::streambuf *cin = std::cin.rdbuf(input.rdbuf());
+        REQUIRE(evaluateLine(globalScope, "once()").toString() == "8");
+        std::cin.rdbuf(cin);
+    }
+}
+
+TEST_CASE("Memoized functions follow redefinitions")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        // Exponential without the memo table
+        evaluateLine(globalScope, "step -> add(#0, #1)");
+        evaluateLine(globalScope, "fib -> if(le(#0, 2), #0, step(fib(sub(#0, 1)), fib(sub(#0, 2))))");
+        REQUIRE(evaluateLine(globalScope, "fib(70)").toString() == "190392490709135");
+        evaluateLine(globalScope, "step -> add(#0, add(#1, 1))");
+        REQUIRE(evaluateLine(globalScope, "fib(10)").toString() == "143");
+
+        // Functions which read input are called every time
+        evaluateLine(globalScope, "input -> if(le(#0, 2), read(), add(input(sub(#0, 1)), input(sub(#0, 2))))");
+        std::istringstream input("1\n2\n3\n4\n5\n");
+        std::streambuf *cin = std::cin.rdbuf(input.rdbuf());
+        REQUIRE(evaluateLine(globalScope, "input(4)").toString() == "15");
+        std::cin.rdbuf(cin);
+    }
+}
+
+TEST_CASE("Memo tables evict the least recently used result")
+{
+    MemoTable table;
+    for (size_t i = 0; i < MemoTable::maxEntries; ++i)
+    {
+        table.insert({Value::makeInt(i)}, Value::makeInt(i));
+    }
+    REQUIRE(table.find({Value::makeInt(0)}).toString() == "0");
+
+    table.insert({Value::makeInt(-1)}, Value::makeInt(-1));
+    REQUIRE(table.size() == MemoTable::maxEntries);
+    REQUIRE(table.find({Value::makeInt(0)}).toString() == "0");
+    REQUIRE(!table.find({Value::makeInt(1)}));
+    // Exact keys, unlike eq()
+    REQUIRE(!table.find({Value::makeReal(0)}));
+}
+
+TEST_CASE("Effects follow redefinitions")
+{
+    GlobalScope globalScope;
+    globalScope.loadDefaultLibrary();
+    EffectAnalysis &effects = globalScope.effects();
+    auto effectsOf = [&](const char *name, size_t argc)
+    {
+        return effects.effectsOf({SymbolTable::intern(name), argc}, globalScope);
+    };
+
+    evaluateLine(globalScope, "isEven -> if(eq(#0, 0), 1, isOdd(sub(#0, 1)))");
+    REQUIRE(effectsOf("isEven", 1) == EffectAnalysis::UNKNOWN);
+    evaluateLine(globalScope, "isOdd -> if(eq(#0, 0), 0, isEven(sub(#0, 1)))");
+    REQUIRE(effectsOf("isEven", 1) == EffectAnalysis::PURE);
+    REQUIRE(effects.recursiveGroupOf({SymbolTable::intern("isOdd"), 1}, globalScope).size() == 2);
+
+    evaluateLine(globalScope, "echo -> write(read())");
+    evaluateLine(globalScope, "loud -> add(echo(), #0)");
+    evaluateLine(globalScope, "each -> map(#0, #1)");
+    REQUIRE(effectsOf("loud", 1) == (EffectAnalysis::READS_INPUT | EffectAnalysis::WRITES_OUTPUT));
+    REQUIRE(effectsOf("each", 2) == EffectAnalysis::UNKNOWN);
+    REQUIRE(effects.recursiveGroupOf({SymbolTable::intern("loud"), 1}, globalScope).empty());
+
+    // Only the redefined function and its callers change
+    const size_t isOddVersion = effects.versionOf({SymbolTable::intern("isOdd"), 1});
+    evaluateLine(globalScope, "write -> #0");
+    REQUIRE(effectsOf("loud", 1) == EffectAnalysis::READS_INPUT);
+    REQUIRE(effects.versionOf({SymbolTable::intern("isOdd"), 1}) == isOddVersion);
+    evaluateLine(globalScope, "isOdd -> if(eq(#0, 0), read(), isEven(sub(#0, 1)))");
+    REQUIRE(effectsOf("isEven", 1) == EffectAnalysis::READS_INPUT);
+    REQUIRE(EffectAnalysis::describe(effectsOf("isEven", 1)) == "reads-input");
+}
+
+TEST_CASE("Arithmetic on proven types follows redefinitions")
+{
+    for (GlobalScope::Engine engine : {GlobalScope::Engine::TREE_WALKER, GlobalScope::Engine::BYTECODE})
+    {
+        GlobalScope globalScope;
+        globalScope.loadDefaultLibrary();
+        globalScope.setEngine(engine);
+
+        // The return type of count is inferred from its own body
+        evaluateLine(globalScope, "count -> if(eq(#0, 0), 0, add(1, count(sub(#0, 1))))");
+        const FunctionApplication *body = dynamic_cast<const FunctionApplication*>(
+            globalScope.findFunction(SymbolTable::intern("count"), 1)->definition.get());
+        REQUIRE(body);
+        REQUIRE(dynamic_cast<const SpecializedArithmeticNode*>(body->arguments[2].get()));
+        REQUIRE(evaluateLine(globalScope, "count(1000)").toString() == "1000");
+
+        evaluateLine(globalScope, "one -> 1");
+        evaluateLine(globalScope, "two -> add(one(), one())");
+        REQUIRE(evaluateLine(globalScope, "two()").toString() == "2");
+        evaluateLine(globalScope, "one -> 1.5");
+        REQUIRE(evaluateLine(globalScope, "two()").toString() == "3.000000");
+        evaluateLine(globalScope, "one -> [1]");
+        REQUIRE_THROWS_AS(evaluateLine(globalScope, "two()"), std::runtime_error);
+        evaluateLine(globalScope, "one -> 4");
+        REQUIRE(evaluateLine(globalScope, "two()").toString() == "8");
+
+        // The proof also goes through inlined bodies
+        evaluateLine(globalScope, "sq -> mul(#0, #0)");
+        evaluateLine(globalScope, "f -> add(sq(2), 1)");
+        REQUIRE(evaluateLine(globalScope, "f()").toString() == "5");
+        evaluateLine(globalScope, "sq -> [#0]");
+        REQUIRE_THROWS_AS(evaluateLine(globalScope, "f()"), std::runtime_error);
+        evaluateLine(globalScope, "sq -> add(#0, 0.5)");
+        REQUIRE(evaluateLine(globalScope, "f()").toString() == "3.500000");
+    }
+}
@@ -0,0 +1,198 @@
+#include "type_inference.h"
+#include "interpreter.h"
+#include "optimizer.h"
+
+
+namespace
+{
+
+// Pre-defined functions which always return an int
+const char* const intBuiltins[] = {"eq", "le", "nand", "length", "mod", "int", "indexOf", "write"};
+
+bool returnsInt(const std::string& name)
+{
+    for (const char* candidate : intBuiltins)
+    {
+        if (name == candidate)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//! Type of add(), sub(), mul() and div(), which compute reals if any operand is one
+TypeInference::Type arithmeticType(TypeInference::Type fst, TypeInference::Type snd)
+{
+    typedef TypeInference::Type Type;
+
+    if (fst == Type::NONE || snd == Type::NONE)
+    {
+        return Type::NONE;
+    }
+    else if (fst == Type::REAL || snd == Type::REAL)
+    {
+        // The other operand is a number or the call throws
+        return Type::REAL;
+    }
+
+    return fst == Type::INT && snd == Type::INT ? Type::INT : Type::ANY;
+}
+
+}
+
+TypeInference::Type TypeInference::typeOf(const Node* node)
+{
+    static const size_t ifSymbol = SymbolTable::intern("if");
+
+    if (dynamic_cast<const IntNode*>(node))
+    {
+        return Type::INT;
+    }
+    else if (dynamic_cast<const DoubleNode*>(node))
+    {
+        return Type::REAL;
+    }
+    else if (const ConstantNode* constant = dynamic_cast<const ConstantNode*>(node))
+    {
+        switch (constant->value.getType())
+        {
+        case Value::Type::INT_NUMBER:
+            return Type::INT;
+        case Value::Type::REAL_NUMBER:
+            return Type::REAL;
+        default:
+            return Type::ANY;
+        }
+    }
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        return typeOf(inlined->tailNode(globalScope));
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        return typeOf(arithmetic->original.get());
+    }
+    else if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        const Function function(call->symbol, call->arguments.size());
+        const FunctionDefinition* definition = globalScope.findFunction(call->symbol, call->arguments.size());
+        if (bodyOf(function) || !definition)
+        {
+            return returnTypeOf(function);
+        }
+
+        const std::string &name = definition->builtin->token.data;
+        if (returnsInt(name))
+        {
+            return Type::INT;
+        }
+        else if (name == "sqrt")
+        {
+            return Type::REAL;
+        }
+        else if (name == "add" || name == "sub" || name == "mul" || name == "div")
+        {
+            return arithmeticType(typeOf(call->arguments[0].get()), typeOf(call->arguments[1].get()));
+        }
+        else if (call->symbol == ifSymbol && call->arguments.size() == 3)
+        {
+            if (typeOf(call->arguments[0].get()) == Type::NONE)
+            {
+                return Type::NONE;
+            }
+
+            return join(typeOf(call->arguments[1].get()), typeOf(call->arguments[2].get()));
+        }
+    }
+
+    return Type::ANY;
+}
+
+TypeInference::Type TypeInference::returnTypeOf(const Function& function)
+{
+    if (!bodyOf(function))
+    {
+        return Type::ANY;
+    }
+
+    auto found = returnTypes.find(function);
+    if (found == returnTypes.end())
+    {
+        solve(function);
+        found = returnTypes.find(function);
+    }
+
+    return found->second;
+}
+
+const Node* TypeInference::bodyOf(const Function& function) const
+{
+    if (function == defined)
+    {
+        return definedBody;
+    }
+
+    const FunctionDefinition* definition = globalScope.findFunction(function.first, function.second);
+
+    return definition && !definition->builtin ? definition->definition.get() : nullptr;
+}
+
+void TypeInference::solve(const Function& function)
+{
+    // Every function starts at NONE and rises until the bodies agree with the types
+    std::vector<Function> functions(1, function);
+    returnTypes[function] = Type::NONE;
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        collectCalls(bodyOf(functions[i]), functions);
+    }
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (const Function &member : functions)
+        {
+            Type type = typeOf(bodyOf(member));
+            if (type != returnTypes[member])
+            {
+                returnTypes[member] = type;
+                changed = true;
+            }
+        }
+    }
+}
+
+void TypeInference::collectCalls(const Node* node, std::vector<Function>& functions)
+{
+    if (const FunctionApplication* call = dynamic_cast<const FunctionApplication*>(node))
+    {
+        const Function callee(call->symbol, call->arguments.size());
+        if (bodyOf(callee) && returnTypes.insert({callee, Type::NONE}).second)
+        {
+            functions.push_back(callee);
+        }
+
+        for (const std::shared_ptr<Node> &arg : call->arguments)
+        {
+            collectCalls(arg.get(), functions);
+        }
+    }
+    else if (const ListLiteralNode* list = dynamic_cast<const ListLiteralNode*>(node))
+    {
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            collectCalls(item.get(), functions);
+        }
+    }
+    else if (const InlinedNode* inlined = dynamic_cast<const InlinedNode*>(node))
+    {
+        collectCalls(inlined->original.get(), functions);
+        collectCalls(inlined->body.get(), functions);
+    }
+    else if (const SpecializedArithmeticNode* arithmetic = dynamic_cast<const SpecializedArithmeticNode*>(node))
+    {
+        collectCalls(arithmetic->original.get(), functions);
+    }
+}
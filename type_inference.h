@@ -0,0 +1,60 @@
+#pragma once
+
+#include "effects.h"
+
+#include <map>
+#include <string>
+
+
+struct Node;
+struct GlobalScope;
+
+//! Infers which expressions always evaluate to ints or always to reals. Parameters may be
+//! anything, the return types of user functions are the least fixed point over their bodies.
+class TypeInference
+{
+public:
+    //! What an expression evaluates to, if it returns at all
+    enum class Type : unsigned char
+    {
+        NONE,   // Never returns, e.g. a function which only calls itself
+        INT,
+        REAL,
+        ANY,
+    };
+
+    typedef EffectAnalysis::Function Function;
+
+    //! Infers with the definitions of globalScope
+    explicit TypeInference(const GlobalScope& globalScope)
+        : globalScope(globalScope), defined(std::string::npos, 0), definedBody(nullptr) {}
+
+    //! Infers as if the function defined already had the body definedBody
+    TypeInference(const GlobalScope& globalScope, const Function& defined, const Node* definedBody)
+        : globalScope(globalScope), defined(defined), definedBody(definedBody) {}
+
+    Type typeOf(const Node* node);
+    //! ANY for pre-defined and undefined functions
+    Type returnTypeOf(const Function& function);
+
+    //! Body of a user function or nullptr for pre-defined and undefined functions
+    const Node* bodyOf(const Function& function) const;
+
+    //! The least type both fst and snd have
+    static Type join(Type fst, Type snd) noexcept
+    {
+        return fst == snd || snd == Type::NONE ? fst : fst == Type::NONE ? snd : Type::ANY;
+    }
+
+private:
+    const GlobalScope& globalScope;
+    const Function defined;
+    const Node* const definedBody;
+    std::map<Function, Type> returnTypes;
+
+    //! Infers the return types of function and of every user function it may call
+    void solve(const Function& function);
+    //! Adds the user functions called by node which have no return type yet
+    void collectCalls(const Node* node, std::vector<Function>& functions);
+
+};
@@ -0,0 +1,739 @@
+#include "vm.h"
+#include "optimizer.h"
+#include "memo.h"
+
+#include <iostream>
+#include <stdexcept>
+
+
+namespace
+{
+
+//! Pre-defined function with a dedicated opcode
+struct BuiltinOpCode
+{
+    const char* name;
+    size_t argc;
+    OpCode op;
+};
+
+// Functions with lazy arguments (nand, if, head, tail, write) are compiled separately
+const BuiltinOpCode strictBuiltins[] = {
+    {"eq", 2, OpCode::EQ}, {"le", 2, OpCode::LE}, {"length", 1, OpCode::LENGTH},
+    {"concat", 2, OpCode::CONCAT}, {"read", 0, OpCode::READ}, {"int", 1, OpCode::INT},
+    {"add", 2, OpCode::ADD}, {"sub", 2, OpCode::SUB}, {"mul", 2, OpCode::MUL},
+    {"div", 2, OpCode::DIV}, {"mod", 2, OpCode::MOD}, {"sqrt", 1, OpCode::SQRT},
+    {"list", 1, OpCode::LIST1}, {"list", 2, OpCode::LIST2}, {"list", 3, OpCode::LIST3},
+};
+
+//! Value stack shared by all nested runs of the VirtualMachine
+std::vector<Value>& valueStack()
+{
+    static thread_local std::vector<Value> stack;
+
+    return stack;
+}
+
+//! Drops the values of a run from the stack, even if it throws
+struct StackFrameGuard
+{
+    std::vector<Value>& stack;
+    const size_t base;
+
+    explicit StackFrameGuard(std::vector<Value>& stack) : stack(stack), base(stack.size()) {}
+    ~StackFrameGuard() { stack.resize(base); }
+};
+
+//! Caller of a function which runs on the VirtualMachine
+struct CallFrame
+{
+    std::shared_ptr<const Chunk> chunk;
+    std::shared_ptr<FunctionScope> scope;
+    size_t pc;      // The CALL instruction
+    size_t base;    // Start of the caller's values on the value stack
+};
+
+//! Memoized call whose result is the result of the function running at depth on the call stack
+struct MemoizedCall
+{
+    size_t depth;
+    std::shared_ptr<MemoTable> table;
+    MemoTable::Key key;
+};
+
+//! Call frames of all nested runs. Kept on the heap, so deep recursion does not
+//! exhaust the native stack.
+std::vector<CallFrame>& callStack()
+{
+    static thread_local std::vector<CallFrame> frames;
+
+    return frames;
+}
+
+//! Drops the frames of a run, even if it throws
+struct CallStackGuard
+{
+    std::vector<CallFrame>& frames;
+    const size_t base;
+
+    explicit CallStackGuard(std::vector<CallFrame>& frames) : frames(frames), base(frames.size()) {}
+    ~CallStackGuard() { frames.resize(base); }
+};
+
+}
+
+Value BytecodeNode::eval(FunctionScope &fncScp) const
+{
+    return VirtualMachine::run(chunk, entry, fncScp);
+}
+
+const FunctionDefinition& CallSite::resolve(const GlobalScope& globalScope) const
+{
+    if (targetEpoch != globalScope.getEpoch())
+    {
+        target = globalScope.findFunction(symbol, arguments.size());
+        targetEpoch = globalScope.getEpoch();
+    }
+
+    if (!target)
+    {
+        throw std::runtime_error("Called function which is not defined");
+    }
+
+    return *target;
+}
+
+bool Chunk::isCurrent(const GlobalScope& globalScope) const
+{
+    if (libraryVersion != globalScope.getLibraryVersion())
+    {
+        return false;
+    }
+    else if (checkedEpoch != globalScope.getEpoch())
+    {
+        for (const std::shared_ptr<const InlinedNode> &node : inlined)
+        {
+            if (!node->isValid(globalScope))
+            {
+                return false;
+            }
+        }
+        for (const std::shared_ptr<const SpecializedArithmeticNode> &node : specialized)
+        {
+            if (!node->isValid(globalScope))
+            {
+                return false;
+            }
+        }
+        checkedEpoch = globalScope.getEpoch();
+    }
+
+    return true;
+}
+
+Compiler::Compiler(const GlobalScope& globalScope)
+    : globalScope(globalScope), chunk(std::make_shared<Chunk>())
+{
+    chunk->libraryVersion = globalScope.getLibraryVersion();
+}
+
+std::shared_ptr<const Chunk> Compiler::compile(const std::shared_ptr<Node>& ast, const GlobalScope& globalScope)
+{
+    Compiler compiler(globalScope);
+
+    compiler.expr(ast, true);
+    compiler.emit(OpCode::RETURN);
+
+    // Every lazy argument gets its own entry, which may add more lazy arguments
+    while (!compiler.pending.empty())
+    {
+        Pending next = compiler.pending.back();
+        compiler.pending.pop_back();
+
+        size_t entry = compiler.chunk->code.size();
+        compiler.expr(next.node, true);
+        compiler.emit(OpCode::RETURN);
+
+        if (next.callSite == std::string::npos)
+        {
+            compiler.chunk->code[next.argument].operand = entry;
+        }
+        else
+        {
+            compiler.chunk->callSites[next.callSite].arguments[next.argument].reset(
+                new BytecodeNode(*compiler.chunk, entry, next.node->token));
+        }
+    }
+
+    return compiler.chunk;
+}
+
+size_t Compiler::emit(OpCode op, size_t operand)
+{
+    chunk->code.push_back({op, static_cast<uint32_t>(operand)});
+
+    return chunk->code.size() - 1;
+}
+
+void Compiler::expr(const std::shared_ptr<Node>& node, bool tail)
+{
+    if (std::shared_ptr<ArgumentNode> arg = std::dynamic_pointer_cast<ArgumentNode>(node))
+    {
+        emit(OpCode::LOAD_ARG, arg->index);
+    }
+    else if (std::shared_ptr<IntNode> literal = std::dynamic_pointer_cast<IntNode>(node))
+    {
+        chunk->constants.push_back(literal->value);
+        emit(OpCode::CONSTANT, chunk->constants.size() - 1);
+    }
+    else if (std::shared_ptr<DoubleNode> literal = std::dynamic_pointer_cast<DoubleNode>(node))
+    {
+        chunk->constants.push_back(literal->value);
+        emit(OpCode::CONSTANT, chunk->constants.size() - 1);
+    }
+    else if (std::shared_ptr<FunctionNameNode> function = std::dynamic_pointer_cast<FunctionNameNode>(node))
+    {
+        chunk->constants.push_back(function->value);
+        emit(OpCode::CONSTANT, chunk->constants.size() - 1);
+    }
+    else if (std::shared_ptr<ConstantNode> constant = std::dynamic_pointer_cast<ConstantNode>(node))
+    {
+        // Chunks are recompiled when the default library changes
+        if (constant->libraryVersion == globalScope.getLibraryVersion())
+        {
+            chunk->constants.push_back(constant->value);
+            emit(OpCode::CONSTANT, chunk->constants.size() - 1);
+        }
+        else
+        {
+            expr(constant->original, tail);
+        }
+    }
+    else if (std::shared_ptr<InlinedNode> inlined = std::dynamic_pointer_cast<InlinedNode>(node))
+    {
+        if (inlined->isValid(globalScope))
+        {
+            chunk->inlined.push_back(inlined);
+            expr(inlined->body, tail);
+        }
+        else
+        {
+            expr(inlined->original, tail);
+        }
+    }
+    else if (std::shared_ptr<SpecializedArithmeticNode> arithmetic =
+             std::dynamic_pointer_cast<SpecializedArithmeticNode>(node))
+    {
+        if (arithmetic->isValid(globalScope))
+        {
+            static const OpCode intOps[] = {OpCode::ADD_INT, OpCode::SUB_INT, OpCode::MUL_INT};
+            static const OpCode realOps[] = {OpCode::ADD_REAL, OpCode::SUB_REAL, OpCode::MUL_REAL};
+            const size_t operation = static_cast<size_t>(arithmetic->operation);
+
+            chunk->specialized.push_back(arithmetic);
+            expr(arithmetic->fst);
+            expr(arithmetic->snd);
+            emit(arithmetic->isInt ? intOps[operation] : realOps[operation]);
+        }
+        else
+        {
+            expr(arithmetic->original, tail);
+        }
+    }
+    else if (std::shared_ptr<ListLiteralNode> list = std::dynamic_pointer_cast<ListLiteralNode>(node))
+    {
+        for (const std::shared_ptr<Node> &item : list->contents)
+        {
+            expr(item);
+        }
+        emit(OpCode::MAKE_LIST, list->contents.size());
+    }
+    else if (std::shared_ptr<FunctionApplication> call = std::dynamic_pointer_cast<FunctionApplication>(node))
+    {
+        application(call, tail);
+    }
+    else
+    {
+        // Function definitions and anything else is left to the tree walker
+        chunk->nodes.push_back(node);
+        emit(OpCode::EVAL_NODE, chunk->nodes.size() - 1);
+    }
+}
+
+void Compiler::application(const std::shared_ptr<FunctionApplication>& node, bool tail)
+{
+    if (builtin(node, tail))
+    {
+        return;
+    }
+
+    emit(tail ? OpCode::TAIL_CALL : OpCode::CALL, addCallSite(node->symbol, node->arguments));
+}
+
+size_t Compiler::addCallSite(size_t symbol, const std::vector<std::shared_ptr<Node>>& arguments)
+{
+    CallSite site;
+    site.symbol = symbol;
+    site.arguments.resize(arguments.size());
+    for (const std::shared_ptr<Node> &arg : arguments)
+    {
+        std::shared_ptr<ArgumentNode> forwarded = std::dynamic_pointer_cast<ArgumentNode>(arg);
+        site.forwarded.push_back(forwarded ? forwarded->index : std::string::npos);
+    }
+    site.target = nullptr;
+    site.targetEpoch = 0;
+    chunk->callSites.push_back(std::move(site));
+
+    size_t callSite = chunk->callSites.size() - 1;
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        pending.push_back({arguments[i], callSite, i});
+    }
+
+    return callSite;
+}
+
+bool Compiler::builtin(const std::shared_ptr<FunctionApplication>& node, bool tail)
+{
+    const std::vector<std::shared_ptr<Node>> &args = node->arguments;
+    const FunctionDefinition* function = globalScope.findFunction(node->symbol, args.size());
+
+    // Only functions which are still the pre-defined ones have opcodes
+    if (!function || !function->builtin)
+    {
+        return false;
+    }
+
+    const std::string &name = node->token.data;
+
+    if (name == "nand")
+    {
+        expr(args[0]);
+        size_t shortCircuit = emit(OpCode::NAND);
+        expr(args[1]);
+        emit(OpCode::NAND_LAST);
+        chunk->code[shortCircuit].operand = chunk->code.size();
+
+        return true;
+    }
+    if (name == "if")
+    {
+        expr(args[0]);
+        size_t elseBranch = emit(OpCode::IF);
+        expr(args[1], tail);
+        size_t end = emit(OpCode::JUMP);
+        chunk->code[elseBranch].operand = chunk->code.size();
+        expr(args[2], tail);
+        chunk->code[end].operand = chunk->code.size();
+
+        return true;
+    }
+    if (name == "head" || name == "tail")
+    {
+        // Like FunctionScope::headOfList() and tailOfList() only the needed elements
+        // of a list literal are evaluated
+        std::shared_ptr<ListLiteralNode> list = std::dynamic_pointer_cast<ListLiteralNode>(args[0]);
+        if (list && name == "head" && !list->contents.empty())
+        {
+            expr(list->contents[0]);
+        }
+        else if (list && name == "tail")
+        {
+            for (size_t i = 1; i < list->contents.size(); ++i)
+            {
+                expr(list->contents[i]);
+            }
+            emit(OpCode::MAKE_LIST, list->contents.empty() ? 0 : list->contents.size() - 1);
+        }
+        else
+        {
+            expr(args[0]);
+            emit(name == "head" ? OpCode::HEAD : OpCode::TAIL);
+        }
+
+        return true;
+    }
+    if (name == "write")
+    {
+        // The argument runs separately, so that its errors can be caught
+        size_t write = emit(OpCode::WRITE);
+        pending.push_back({args[0], std::string::npos, write});
+
+        return true;
+    }
+
+    if (name == "concat")
+    {
+        // Like concatFunc() a list built by recursion is computed only as far as it is used. The
+        // callee may still be redefined, so LAZY_CONCAT checks it when it runs.
+        std::shared_ptr<FunctionApplication> rest = std::dynamic_pointer_cast<FunctionApplication>(args[1]);
+        const FunctionDefinition* restFunction = rest ?
+            globalScope.findFunction(rest->symbol, rest->arguments.size()) : nullptr;
+
+        if ((restFunction && !restFunction->builtin) || std::dynamic_pointer_cast<InlinedNode>(args[1]))
+        {
+            expr(args[0]);
+            size_t callSite = addCallSite(node->symbol, std::vector<std::shared_ptr<Node>>(1, args[1]));
+            chunk->callSites[callSite].rest = args[1];
+            emit(OpCode::LAZY_CONCAT, callSite);
+
+            return true;
+        }
+    }
+
+    for (const BuiltinOpCode &op : strictBuiltins)
+    {
+        if (name == op.name && args.size() == op.argc)
+        {
+            for (const std::shared_ptr<Node> &arg : args)
+            {
+                expr(arg);
+            }
+            emit(op.op);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Value VirtualMachine::evaluate(const std::shared_ptr<Node>& ast, FunctionScope& fncScp)
+{
+    std::shared_ptr<const Chunk> chunk = Compiler::compile(ast, fncScp.getGlobalScope());
+
+    return run(*chunk, 0, fncScp);
+}
+
+Value VirtualMachine::call(const FunctionDefinition& function, FunctionScope& fncScp)
+{
+    if (function.builtin)
+    {
+        return function.builtin->eval(fncScp);
+    }
+
+    // Keeps the code alive even if the function is redefined while it runs
+    std::shared_ptr<const Chunk> chunk = bytecodeOf(function, fncScp.getGlobalScope());
+
+    return run(*chunk, 0, fncScp);
+}
+
+std::shared_ptr<const Chunk> VirtualMachine::bytecodeOf(const FunctionDefinition& function,
+                                                        const GlobalScope& globalScope)
+{
+    if (!function.bytecode || !function.bytecode->isCurrent(globalScope))
+    {
+        function.bytecode = Compiler::compile(function.definition, globalScope);
+    }
+
+    return function.bytecode;
+}
+
+std::shared_ptr<FunctionScope> VirtualMachine::makeScope(const CallSite& site, const FunctionDefinition& function,
+                                                         const std::shared_ptr<const Chunk>& owner, FunctionScope& fncScp)
+{
+    std::shared_ptr<FunctionScope> parentScope = fncScp.shared_from_this();
+    std::vector<std::shared_ptr<Thunk>> thunks;
+    thunks.reserve(site.arguments.size());
+
+    for (size_t i = 0; i < site.arguments.size(); ++i)
+    {
+        std::shared_ptr<Thunk> thunk;
+        if (!function.builtin && site.forwarded[i] != std::string::npos)
+        {
+            thunk = fncScp.getThunk(site.forwarded[i]);
+        }
+
+        // The arguments share ownership of the chunk their code lives in
+        thunks.push_back(thunk ? std::move(thunk) : std::make_shared<Thunk>(
+            std::shared_ptr<Node>(owner, site.arguments[i].get()), parentScope));
+    }
+
+    return std::make_shared<FunctionScope>(fncScp.getGlobalScope(), std::move(thunks));
+}
+
+Value VirtualMachine::run(const Chunk& entryChunk, size_t entry, FunctionScope& entryScope)
+{
+    std::vector<Value>& stack = valueStack();
+    StackFrameGuard guard(stack);
+    std::vector<CallFrame>& frames = callStack();
+    CallStackGuard framesGuard(frames);
+    GlobalScope& globalScope = entryScope.getGlobalScope();
+    const Chunk* chunk = &entryChunk;
+    FunctionScope* fncScp = &entryScope;
+    size_t base = guard.base;
+    // Keep the running code and scope alive once a call replaces the entry ones
+    std::shared_ptr<const Chunk> chunkOwner;
+    std::shared_ptr<FunctionScope> scopeOwner;
+    std::vector<MemoizedCall> memoized;
+
+    for (size_t pc = entry;; ++pc)
+    {
+        const Instruction &instr = chunk->code[pc];
+
+        switch (instr.op)
+        {
+        case OpCode::CONSTANT:
+            stack.push_back(chunk->constants[instr.operand]);
+            break;
+        case OpCode::LOAD_ARG:
+            stack.push_back(fncScp->nth(instr.operand));
+            break;
+        case OpCode::MAKE_LIST:
+        {
+            std::vector<Value> values(std::make_move_iterator(stack.end() - instr.operand),
+                                      std::make_move_iterator(stack.end()));
+            stack.resize(stack.size() - instr.operand);
+            stack.push_back(Value::makeList<ListLiteralValue>(std::move(values)));
+        }
+            break;
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        {
+            const CallSite &site = chunk->callSites[instr.operand];
+            const FunctionDefinition &function = site.resolve(globalScope);
+
+            if (!chunkOwner)
+            {
+                chunkOwner = chunk->shared_from_this();
+            }
+
+            std::shared_ptr<FunctionScope> localScope = makeScope(site, function, chunkOwner, *fncScp);
+
+            if (function.builtin)
+            {
+                stack.push_back(call(function, *localScope));
+                break;
+            }
+
+            std::shared_ptr<MemoTable> memo = globalScope.memoOf(function);
+            MemoTable::Key key;
+            if (memo)
+            {
+                key = MemoTable::keyOf(*localScope);
+                if (Value res = memo->find(key))
+                {
+                    stack.push_back(std::move(res));
+                    break;
+                }
+            }
+
+            if (instr.op == OpCode::CALL)
+            {
+                if (frames.size() >= globalScope.getMaxDepth())
+                {
+                    throw std::runtime_error("Maximum recursion depth exceeded");
+                }
+
+                if (!scopeOwner)
+                {
+                    scopeOwner = fncScp->shared_from_this();
+                }
+
+                frames.push_back({std::move(chunkOwner), std::move(scopeOwner), pc, base});
+                base = stack.size();
+            }
+            else
+            {
+                stack.resize(base);
+            }
+
+            if (memo)
+            {
+                memoized.push_back({frames.size(), std::move(memo), std::move(key)});
+            }
+
+            // The callee continues in this run, the caller resumes at RETURN
+            std::shared_ptr<const Chunk> callee = bytecodeOf(function, globalScope);
+            if (instr.op == OpCode::TAIL_CALL && callee == chunkOwner)
+            {
+                Memo::forceArguments(function, *localScope);
+            }
+            chunkOwner = std::move(callee);
+            chunk = chunkOwner.get();
+            scopeOwner = std::move(localScope);
+            fncScp = scopeOwner.get();
+            pc = static_cast<size_t>(-1);
+        }
+            break;
+        case OpCode::EVAL_NODE:
+            stack.push_back(chunk->nodes[instr.operand]->eval(*fncScp));
+            break;
+        case OpCode::JUMP:
+            pc = instr.operand - 1;
+            break;
+        case OpCode::RETURN:
+        {
+            while (!memoized.empty() && memoized.back().depth == frames.size())
+            {
+                memoized.back().table->insert(memoized.back().key, stack.back());
+                memoized.pop_back();
+            }
+
+            if (frames.size() == framesGuard.base)
+            {
+                return std::move(stack.back());
+            }
+
+            Value res = std::move(stack.back());
+            stack.resize(base);
+            stack.push_back(std::move(res));
+
+            CallFrame &caller = frames.back();
+            chunkOwner = std::move(caller.chunk);
+            chunk = chunkOwner.get();
+            scopeOwner = std::move(caller.scope);
+            fncScp = scopeOwner.get();
+            pc = caller.pc;
+            base = caller.base;
+            frames.pop_back();
+        }
+            break;
+
+        case OpCode::EQ:
+            stack[stack.size() - 2] = Value::makeInt(Builtins::equal(stack[stack.size() - 2], stack.back()));
+            stack.pop_back();
+            break;
+        case OpCode::LE:
+            stack[stack.size() - 2] = Builtins::le(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::NAND:
+            if (!Builtins::nandOperand(stack.back()))
+            {
+                stack.back() = Value::makeInt(1);
+                pc = instr.operand - 1;
+            }
+            else
+            {
+                stack.pop_back();
+            }
+            break;
+        case OpCode::NAND_LAST:
+            stack.back() = Value::makeInt(!Builtins::nandOperand(stack.back()));
+            break;
+        case OpCode::LENGTH:
+            stack.back() = Builtins::length(stack.back());
+            break;
+        case OpCode::HEAD:
+            stack.back() = Builtins::head(stack.back());
+            break;
+        case OpCode::TAIL:
+            stack.back() = Builtins::tail(stack.back());
+            break;
+        case OpCode::LAZY_CONCAT:
+        {
+            const CallSite &site = chunk->callSites[instr.operand];
+
+            if (!chunkOwner)
+            {
+                chunkOwner = chunk->shared_from_this();
+            }
+
+            std::shared_ptr<Thunk> rest = std::make_shared<Thunk>(
+                std::shared_ptr<Node>(chunkOwner, site.arguments[0].get()), fncScp->shared_from_this());
+            if (Builtins::isLazyRest(site.rest.get(), globalScope))
+            {
+                stack.back() = Builtins::lazyConcat(stack.back(), rest);
+            }
+            else
+            {
+                stack.back() = Builtins::concat(stack.back(), rest->force());
+            }
+        }
+            break;
+        case OpCode::CONCAT:
+            stack[stack.size() - 2] = Builtins::concat(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::IF:
+        {
+            bool condition = Builtins::condition(stack.back());
+            stack.pop_back();
+            if (!condition)
+            {
+                pc = instr.operand - 1;
+            }
+        }
+            break;
+        case OpCode::READ:
+            stack.push_back(Builtins::read());
+            break;
+        case OpCode::WRITE:
+        {
+            Value res = Value::makeInt(0);
+            try
+            {
+                std::cout << run(*chunk, instr.operand, *fncScp).toString() << std::endl;
+            }
+            catch (...)
+            {
+                res = Value::makeInt(1);
+            }
+            stack.push_back(res);
+        }
+            break;
+        case OpCode::INT:
+            stack.back() = Builtins::toInt(stack.back());
+            break;
+        case OpCode::ADD:
+            stack[stack.size() - 2] = Builtins::add(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::SUB:
+            stack[stack.size() - 2] = Builtins::sub(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::MUL:
+            stack[stack.size() - 2] = Builtins::mul(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::ADD_INT:
+            stack[stack.size() - 2] = Value::makeInt(Builtins::add(stack[stack.size() - 2].asInt(), stack.back().asInt()));
+            stack.pop_back();
+            break;
+        case OpCode::ADD_REAL:
+            stack[stack.size() - 2] = Value::makeReal(Builtins::add(stack[stack.size() - 2].asReal(), stack.back().asReal()));
+            stack.pop_back();
+            break;
+        case OpCode::SUB_INT:
+            stack[stack.size() - 2] = Value::makeInt(Builtins::sub(stack[stack.size() - 2].asInt(), stack.back().asInt()));
+            stack.pop_back();
+            break;
+        case OpCode::SUB_REAL:
+            stack[stack.size() - 2] = Value::makeReal(Builtins::sub(stack[stack.size() - 2].asReal(), stack.back().asReal()));
+            stack.pop_back();
+            break;
+        case OpCode::MUL_INT:
+            stack[stack.size() - 2] = Value::makeInt(Builtins::mul(stack[stack.size() - 2].asInt(), stack.back().asInt()));
+            stack.pop_back();
+            break;
+        case OpCode::MUL_REAL:
+            stack[stack.size() - 2] = Value::makeReal(Builtins::mul(stack[stack.size() - 2].asReal(), stack.back().asReal()));
+            stack.pop_back();
+            break;
+        case OpCode::DIV:
+            stack[stack.size() - 2] = Builtins::div(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::MOD:
+            stack[stack.size() - 2] = Builtins::mod(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::SQRT:
+            stack.back() = Builtins::sqrt(stack.back());
+            break;
+        case OpCode::LIST1:
+            stack.back() = Builtins::list(stack.back());
+            break;
+        case OpCode::LIST2:
+            stack[stack.size() - 2] = Builtins::list(stack[stack.size() - 2], stack.back());
+            stack.pop_back();
+            break;
+        case OpCode::LIST3:
+            stack[stack.size() - 3] = Builtins::list(stack[stack.size() - 3], stack[stack.size() - 2], stack.back());
+            stack.resize(stack.size() - 2);
+            break;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "parser.h"
+#include "interpreter.h"
+
+#include <cstdint>
+
+
+//! Instructions of the VirtualMachine
+enum class OpCode : uint8_t
+{
+    CONSTANT,   // Pushes constants[operand]
+    LOAD_ARG,   // Pushes the value of argument #operand
+    MAKE_LIST,  // Pops operand values and pushes them as a list literal
+    CALL,       // Calls callSites[operand], its arguments are passed as thunks
+    TAIL_CALL,  // Like CALL, but a user defined function replaces the running code and scope
+    EVAL_NODE,  // Evaluates nodes[operand] with the tree walker
+    JUMP,       // Continues at operand
+    RETURN,     // Returns the top of the stack
+
+    // Pre-defined functions
+    EQ,
+    LE,
+    NAND,       // Pops the first operand, if it is false pushes 1 and continues at operand
+    NAND_LAST,  // Pops the second operand and pushes the result of nand()
+    LENGTH,
+    HEAD,
+    TAIL,
+    CONCAT,
+    LAZY_CONCAT,  // concat() whose second operand is the only argument of callSites[operand]
+    IF,         // Pops the condition and continues at operand if it is false
+    READ,
+    WRITE,      // Runs the code at operand and writes its result, pushes 0 or 1
+    INT,
+    ADD,
+    SUB,
+    MUL,
+    // add(), sub() and mul() on operands which are proven to be ints or reals
+    ADD_INT,
+    ADD_REAL,
+    SUB_INT,
+    SUB_REAL,
+    MUL_INT,
+    MUL_REAL,
+    DIV,
+    MOD,
+    SQRT,
+    LIST1,
+    LIST2,
+    LIST3,
+};
+
+//! Single instruction of a Chunk
+struct Instruction
+{
+    OpCode op;
+    uint32_t operand;
+};
+
+struct Chunk;
+struct InlinedNode;
+struct SpecializedArithmeticNode;
+
+//! Argument compiled to bytecode. Evaluated lazily, like every argument, through a Thunk.
+struct BytecodeNode : public Node
+{
+    const Chunk &chunk;
+    const size_t entry;
+
+    BytecodeNode(const Chunk &chunk, size_t entry, const Token &token)
+        : Node(token), chunk(chunk), entry(entry) {}
+
+    //! Runs the code of the argument on the VirtualMachine
+    Value eval(FunctionScope &fncScp) const override;
+
+    size_t getArgc() const override
+    {
+        return 0;
+    }
+};
+
+//! Call of a function which is not compiled to a dedicated opcode
+struct CallSite
+{
+    size_t symbol;
+    std::vector<std::unique_ptr<BytecodeNode>> arguments;
+    // For every argument which is just #idx holds idx, otherwise npos
+    std::vector<size_t> forwarded;
+    // The uncompiled argument of LAZY_CONCAT, which decides whether it is computed lazily
+    std::shared_ptr<Node> rest;
+
+    // Definition resolved by the last call, valid while the GlobalScope epoch is unchanged
+    mutable const FunctionDefinition* target;
+    mutable size_t targetEpoch;
+
+    //! Returns the called definition. Throws if the function is not defined.
+    const FunctionDefinition& resolve(const GlobalScope& globalScope) const;
+};
+
+//! Compiled expression or function body. The expression starts at 0 and
+//! the code of its lazy arguments follows it.
+struct Chunk : public std::enable_shared_from_this<Chunk>
+{
+    std::vector<Instruction> code;
+    std::vector<Value> constants;
+    std::vector<CallSite> callSites;
+    std::vector<std::shared_ptr<Node>> nodes;
+
+    //! GlobalScope::getLibraryVersion() at the time of compilation
+    size_t libraryVersion;
+    //! Inlined calls whose bodies were compiled
+    std::vector<std::shared_ptr<const InlinedNode>> inlined;
+    //! Specialized arithmetic which was compiled to typed opcodes
+    std::vector<std::shared_ptr<const SpecializedArithmeticNode>> specialized;
+
+    //! False if the code was compiled for another default library, a compiled inlined
+    //! function was redefined or the proof of compiled specialized arithmetic broke since
+    bool isCurrent(const GlobalScope& globalScope) const;
+
+private:
+    // GlobalScope::getEpoch() when inlined and specialized were last checked
+    mutable size_t checkedEpoch = 0;
+};
+
+//! Compiles an abstract syntax tree to bytecode
+class Compiler
+{
+public:
+    //! Returns the compiled ast. Pre-defined functions become dedicated opcodes.
+    static std::shared_ptr<const Chunk> compile(const std::shared_ptr<Node>& ast, const GlobalScope& globalScope);
+
+private:
+    //! Code which is compiled after the current expression
+    struct Pending
+    {
+        std::shared_ptr<Node> node;
+        size_t callSite;    // Call site of an argument or npos
+        size_t argument;    // Index of the argument or of the instruction to patch
+    };
+
+    const GlobalScope& globalScope;
+    std::shared_ptr<Chunk> chunk;
+    std::vector<Pending> pending;
+
+    Compiler(const GlobalScope& globalScope);
+
+    //! Emits an instruction and returns its index
+    size_t emit(OpCode op, size_t operand = 0);
+    //! Compiles code which leaves the value of node on the stack. A node in tail position
+    //! is followed only by the RETURN of its entry.
+    void expr(const std::shared_ptr<Node>& node, bool tail = false);
+    //! Compiles a function application
+    void application(const std::shared_ptr<FunctionApplication>& node, bool tail);
+    //! Compiles a call to a pre-defined function. False if it has no dedicated opcode.
+    bool builtin(const std::shared_ptr<FunctionApplication>& node, bool tail);
+    //! Adds a call site whose arguments are compiled as separate entries
+    size_t addCallSite(size_t symbol, const std::vector<std::shared_ptr<Node>>& arguments);
+
+};
+
+//! Stack based virtual machine which executes Chunks
+class VirtualMachine
+{
+public:
+    //! Compiles and runs an expression
+    static Value evaluate(const std::shared_ptr<Node>& ast, FunctionScope& fncScp);
+
+    //! Runs the code of chunk starting from entry
+    static Value run(const Chunk& chunk, size_t entry, FunctionScope& fncScp);
+
+    //! Runs a function, fncScp holds its arguments
+    static Value call(const FunctionDefinition& function, FunctionScope& fncScp);
+
+private:
+    //! Returns the compiled body of a user defined function
+    static std::shared_ptr<const Chunk> bytecodeOf(const FunctionDefinition& function, const GlobalScope& globalScope);
+
+    //! Creates the scope of a call. Arguments which are just #idx share the thunk of the
+    //! caller when a user defined function is called, so they never build chains of thunks.
+    static std::shared_ptr<FunctionScope> makeScope(const CallSite& site, const FunctionDefinition& function,
+                                                    const std::shared_ptr<const Chunk>& owner, FunctionScope& fncScp);
+
+};
\ No newline at end of file